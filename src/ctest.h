@@ -8,14 +8,35 @@
 #include <ctest_atomic.h>
 #include <stdint.h>
 #include <getopt.h>
+#include <setjmp.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <poll.h>
+#include <regex.h>
+#if defined(__GLIBC__) && !defined(CTEST_NO_MALLOC_HOOK)
+#include <malloc.h>
+#define CTEST_TEST_MALLOC_HOOK 1
+#endif
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <ctest_string.h>
+#include <ctest_profile.h>
+#include <ctest_trace.h>
+#include <ctest_prop.h>
+#include <ctest_bench.h>
 
 CTEST_CPP_START
 
 typedef struct ctest_test_func_t ctest_test_func_t;
 typedef struct ctest_test_case_t ctest_test_case_t;
 typedef struct cmdline_param_t cmdline_param_t;
+typedef struct ctest_test_site_t ctest_test_site_t;
+typedef struct ctest_test_death_t ctest_test_death_t;
 typedef void ctest_test_func_pt();
 
 struct ctest_test_case_t {
@@ -28,6 +49,7 @@ struct ctest_test_case_t {
     ctest_hash_list_t          hash_node;
     ctest_list_t               list;
     int                       list_cnt;
+    int                       pending;
 };
 
 // struct test
@@ -37,16 +59,65 @@ struct ctest_test_func_t {
     ctest_test_func_pt         *func;
     ctest_list_t               listnode;
     int                       ret;
+    int64_t                   mem_limit;
 };
 // cmdline parameter
+#define CTEST_TEST_MAX_LOAD    64
+#define CTEST_TEST_DEATH_ERR   16384
+#define CTEST_TEST_DEATH_RET   'R'
+#define CTEST_TEST_DEATH_MISS  'M'
 struct cmdline_param_t {
     const char                *filter_str;
     int                       filter_str_len;
     int                       filter_flags;
+    const char                *profile_dir;
+    const char                *trace_file;
+    int                       site_limit;
+    int                       update_golden;
+    int                       prop_cases;
+    int                       prop_jobs;
+    uint64_t                  prop_seed;
+    int                       bench_rounds;
+    const char                *bench_csv;
+    int                       list;
+    int                       load_cnt;
+    const char                *load[CTEST_TEST_MAX_LOAD];
+    const char                *serve_path;
+    int                       death_fork;
+    int64_t                   mem_limit;
+    int                       mem_stats;
+};
+
+// EXPECT_DEATH/EXPECT_EXIT, 子进程由启动时fork的zygote生成, 重跑当前测试到第target个death点
+struct ctest_test_death_t {
+    ctest_test_func_t          *func;
+    int                       seq;
+    int                       target;
+    int                       fd;
+    int                       zygote_fd;
+    pid_t                     zygote_pid;
+    int                       status;
+    int                       flag;
+    int                       len;
+    char                      err[CTEST_TEST_DEATH_ERR];
+};
+
+// 每个EXPECT/ASSERT调用点一个, 统计当前测试里的失败次数
+struct ctest_test_site_t {
+    const char                *file;
+    int                       line;
+    const char                *expr;
+    int                       seq;
+    int64_t                   count;
+    ctest_test_site_t          *next;
+    char                      first[128];
+    char                      last[128];
 };
 
 #define CTEST_TEST_COLOR_RED   1
 #define CTEST_TEST_COLOR_GREEN 2
+#define CTEST_TEST_SITE_LIMIT  10
+#define CTEST_TEST_DUMP_ROWS   4
 
 // extern
 extern ctest_pool_t      *ctest_test_pool;
@@ -54,6 +125,30 @@ extern ctest_hash_t      *ctest_test_case_table;
 extern ctest_list_t      ctest_test_case_list;
 extern int              ctest_test_retval;
 extern ctest_atomic_t    ctest_test_alloc_byte;
+extern int              ctest_test_seq;
+extern int              ctest_test_site_limit;
+extern int              ctest_test_update_golden;
+extern int              ctest_test_quiet;
+extern ctest_test_death_t ctest_test_death;
+extern ctest_atomic_t    ctest_test_mem_cur;
+extern ctest_atomic_t    ctest_test_mem_peak;
+extern int64_t          ctest_test_mem_base;
+extern int64_t          ctest_test_mem_limit;
+extern int              ctest_test_mem_over;
+extern int              ctest_test_mem_track;
+#ifdef CTEST_TEST_MALLOC_HOOK
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+#endif
+extern ctest_test_site_t *ctest_test_site_list;
+extern ctest_atomic_t    ctest_test_site_lock;
+extern jmp_buf          ctest_test_jmp;
+extern int              ctest_test_jmp_set;
 
 // color printf
 static inline void ctest_test_color_printf(int color, const char *fmt, ...)
@@ -105,20 +200,632 @@ static ctest_test_case_t *ctest_test_get_tc(const char *case_name)
     return tc;
 }
 
-static inline void ctest_test_reg_func(const char *case_name, const char *func_name,
-                                      ctest_test_func_pt *func, int before)
+static inline ctest_test_func_t *ctest_test_new_func(ctest_test_case_t *tc, const char *func_name)
 {
     ctest_test_func_t        *t;
-    ctest_test_case_t        *tc;
 
-    tc = ctest_test_get_tc(case_name);
     t = (ctest_test_func_t *)ctest_pool_calloc(ctest_test_pool, sizeof(ctest_test_func_t));
     t->func_name = func_name;
-    t->func = func;
     t->tc = tc;
 
     ctest_list_add_head(&t->listnode, &tc->list);
     tc->list_cnt ++;
+    return t;
+}
+
+/**
+ * TEST_MEM_LIMIT用, 按名字找, 没有就先占个位, TEST注册时填上
+ */
+static inline ctest_test_func_t *ctest_test_get_func(const char *case_name, const char *func_name)
+{
+    ctest_test_func_t        *t;
+    ctest_test_case_t        *tc;
+
+    tc = ctest_test_get_tc(case_name);
+
+    ctest_list_for_each_entry(t, &tc->list, listnode) {
+        if (strcmp(t->func_name, func_name) == 0)
+            return t;
+    }
+
+    tc->pending ++;
+    return ctest_test_new_func(tc, func_name);
+}
+
+/**
+ * 同名的TEST也都加进去; 只有TEST_MEM_LIMIT占过位时才查找
+ */
+static inline void ctest_test_reg_func(const char *case_name, const char *func_name,
+                                      ctest_test_func_pt *func, int before)
+{
+    ctest_test_func_t        *t;
+    ctest_test_case_t        *tc;
+
+    tc = ctest_test_get_tc(case_name);
+
+    if (tc->pending > 0) {
+        ctest_list_for_each_entry(t, &tc->list, listnode) {
+            if (t->func == NULL && strcmp(t->func_name, func_name) == 0) {
+                tc->pending --;
+                t->func = func;
+                return;
+            }
+        }
+    }
+
+    ctest_test_new_func(tc, func_name)->func = func;
+}
+
+/**
+ * 内存统计, malloc和pool的allocator都走这里; 超过当前测试的预算马上报错
+ */
+static inline void ctest_test_mem_add(int64_t size)
+{
+    static __thread int     reporting = 0;
+    int64_t                 cur, peak;
+
+    cur = ctest_atomic_add_return(&ctest_test_mem_cur, size);
+
+    while(cur > (peak = ctest_test_mem_peak)) {
+        if (ctest_atomic_cmp_set(&ctest_test_mem_peak, peak, cur))
+            break;
+    }
+
+    if (unlikely(ctest_test_mem_limit > 0 && cur - ctest_test_mem_base > ctest_test_mem_limit)
+            && ctest_test_mem_over == 0 && reporting == 0) {
+        reporting = 1;
+        ctest_test_mem_over = 1;
+        ctest_test_retval = 1;
+        printf("ERROR memory limit exceeded: %" PRId64 " bytes in use, limit %" PRId64 "\n",
+               cur - ctest_test_mem_base, ctest_test_mem_limit);
+        reporting = 0;
+    }
+}
+
+/**
+ * 记录一次失败, 同一个调用点超过site_limit次以后不再打印, 测试结束时汇总
+ */
+static inline void ctest_test_site_fail(ctest_test_site_t *site, const char *expr, const char *fmt, ...)
+__attribute__ ((__format__ (__printf__, 3, 4)));
+static inline void ctest_test_site_fail(ctest_test_site_t *site, const char *expr, const char *fmt, ...)
+{
+    va_list                 args;
+    char                    values[4096], *p;
+    int64_t                 count;
+
+    ctest_test_retval = 1;
+
+    // property在找反例和缩小时不输出
+    if (ctest_test_quiet)
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(values, sizeof(values), fmt, args);
+    va_end(args);
+
+    ctest_spin_lock(&ctest_test_site_lock);
+
+    if (site->seq != ctest_test_seq) {
+        site->seq = ctest_test_seq;
+        site->count = 0;
+        site->next = ctest_test_site_list;
+        ctest_test_site_list = site;
+    }
+
+    count = ++ site->count;
+
+    site->expr = expr;
+
+    if (count == 1)
+        ctest_strncpy(site->first, values, sizeof(site->first));
+
+    ctest_strncpy(site->last, values, sizeof(site->last));
+
+    // 汇总在一行里
+    for(p = site->first; *p; p++) if (*p == '\n') *p = ' ';
+
+    for(p = site->last; *p; p++) if (*p == '\n') *p = ' ';
+
+    ctest_spin_unlock(&ctest_test_site_lock);
+
+    if (ctest_test_site_limit <= 0 || count <= ctest_test_site_limit) {
+        printf("ERROR at %s:%d, %s%s\n", site->file, site->line, expr, values);
+    } else if (count == ctest_test_site_limit + 1) {
+        printf("ERROR at %s:%d, more failures suppressed\n", site->file, site->line);
+    }
+}
+
+static inline void ctest_test_site_summary()
+{
+    ctest_test_site_t        *site;
+
+    for(site = ctest_test_site_list; site; site = site->next) {
+        if (ctest_test_site_limit <= 0 || site->count <= ctest_test_site_limit)
+            continue;
+
+        printf("ERROR at %s:%d, %s failed %" PRId64 " times (first%s, last%s)\n",
+               site->file, site->line, site->expr, site->count, site->first, site->last);
+    }
+
+    ctest_test_site_list = NULL;
+}
+
+/**
+ * 不相同的位置前后各一行, 每行16字节, a和b对照输出
+ */
+static inline int ctest_test_mem_dump(char *buf, int size, int64_t off,
+                                      const void *a, size_t alen, const void *b, size_t blen)
+{
+    char                    ha[40], hb[40];
+    int64_t                 start, end, row;
+    int                     len = 0;
+
+    start = ctest_max((off & ~15L) - 16, 0);
+    end = ctest_min(start + CTEST_TEST_DUMP_ROWS * 16, (int64_t)ctest_max(alen, blen));
+
+    for(row = start; row < end && len < size; row += 16) {
+        ctest_string_tohex((const char *)a + row, (row < (int64_t)alen ? ctest_min(alen - row, 16) : 0), ha, sizeof(ha));
+        ctest_string_tohex((const char *)b + row, (row < (int64_t)blen ? ctest_min(blen - row, 16) : 0), hb, sizeof(hb));
+        len += lnprintf(buf + len, size - len, "\n%c %08" PRIx64 "  a=%-32s  b=%s",
+                        (row <= off && off < row + 16 ? '>' : ' '), row, ha, hb);
+    }
+
+    return len;
+}
+
+static inline void ctest_test_mem_eq(ctest_test_site_t *site, const char *expr,
+                                     const void *a, size_t alen, const void *b, size_t blen)
+{
+    char                    buf[1024];
+    int64_t                 off;
+
+    off = ctest_string_mismatch(a, b, ctest_min(alen, blen));
+
+    if (likely(off < 0 && alen == blen))
+        return;
+
+    if (off < 0)
+        off = ctest_min(alen, blen);
+
+    ctest_test_mem_dump(buf, sizeof(buf), off, a, alen, b, blen);
+    ctest_test_site_fail(site, expr, " (offset=%" PRId64 ", len=%ld/%ld)%s", off, (long)alen, (long)blen, buf);
+}
+
+/**
+ * 和golden文件比较, golden文件mmap进来; --update-golden时重写golden文件
+ */
+static inline void ctest_test_file_eq(ctest_test_site_t *site, const char *expr,
+                                      const void *buf, size_t len, const char *filename)
+{
+    char                    tmpname[512];
+    struct stat             st;
+    void                    *data;
+    int                     fd;
+
+    if (ctest_test_update_golden) {
+        lnprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", filename, (int)getpid());
+
+        if ((fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+                || write(fd, buf, len) != (ssize_t)len || close(fd) != 0
+                || rename(tmpname, filename) != 0) {
+            ctest_test_site_fail(site, expr, " update %s: %s", filename, strerror(errno));
+            unlink(tmpname);
+        }
+
+        return;
+    }
+
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        ctest_test_site_fail(site, expr, " %s: %s, run with --update-golden to create it",
+                             filename, strerror(errno));
+
+        if (fd >= 0) close(fd);
+
+        return;
+    }
+
+    data = NULL;
+
+    if (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        ctest_test_site_fail(site, expr, " mmap %s: %s", filename, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    close(fd);
+    ctest_test_mem_eq(site, expr, buf, len, data, st.st_size);
+
+    if (data) munmap(data, st.st_size);
+}
+
+/**
+ * C++里ASSERT_*抛这个, 在TEST自己的函数里接住, 不跨过C的frame, 析构会执行
+ */
+#ifdef __cplusplus
+struct ctest_test_abort_t {};
+#define CTEST_TEST_GUARD(f) ([]() { try { f(); } catch (ctest_test_abort_t &) {} })
+#else
+#define CTEST_TEST_GUARD(f) f
+#endif
+
+/**
+ * TEST_PROP的每个case, ASSERT_*只结束这一个case
+ */
+typedef void (ctest_test_prop_pt)(ctest_prop_t *prop);
+static inline int ctest_test_prop_check(ctest_prop_t *prop, void *args)
+{
+    jmp_buf                 saved;
+    int                     saved_set, ret;
+
+    memcpy(saved, ctest_test_jmp, sizeof(jmp_buf));
+    saved_set = ctest_test_jmp_set;
+    ctest_test_retval = 0;
+    ctest_test_quiet = !prop->show;
+
+#ifdef __cplusplus
+    try {
+        ctest_test_jmp_set = 1;
+        (*(ctest_test_prop_pt *)args)(prop);
+    } catch (ctest_test_abort_t &) {
+    }
+#else
+    if (setjmp(ctest_test_jmp) == 0) {
+        ctest_test_jmp_set = 1;
+        (*(ctest_test_prop_pt *)args)(prop);
+    }
+#endif
+
+    ret = ctest_test_retval;
+    memcpy(ctest_test_jmp, saved, sizeof(jmp_buf));
+    ctest_test_jmp_set = saved_set;
+    ctest_test_quiet = 0;
+
+    return ret;
+}
+
+static inline void ctest_test_prop_run(const char *name, ctest_test_prop_pt *func)
+{
+    if (ctest_prop_run(name, ctest_test_prop_check, (void *)func) != CTEST_OK)
+        ctest_test_retval = 1;
+}
+
+/**
+ * ASSERT_*失败, 回到ctest_test_exec_case; C++里抛ctest_test_abort_t
+ */
+static inline void ctest_test_abort()
+{
+    if (ctest_test_jmp_set) {
+        ctest_test_jmp_set = 0;
+#ifdef __cplusplus
+        throw ctest_test_abort_t();
+#else
+        longjmp(ctest_test_jmp, 1);
+#endif
+    }
+}
+
+/**
+ * 带一个fd发送/接收, SCM_RIGHTS
+ */
+static inline int ctest_test_death_send(int sock, const void *data, int len, int fd)
+{
+    struct msghdr           msg;
+    struct iovec            iov;
+    struct cmsghdr          *cm;
+    char                    buf[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        msg.msg_control = buf;
+        msg.msg_controllen = sizeof(buf);
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+
+    return (sendmsg(sock, &msg, 0) == len ? CTEST_OK : CTEST_ERROR);
+}
+
+static inline int ctest_test_death_recv(int sock, void *data, int len, int *fd)
+{
+    struct msghdr           msg;
+    struct iovec            iov;
+    struct cmsghdr          *cm;
+    char                    buf[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof(buf);
+
+    if (recvmsg(sock, &msg, 0) != len)
+        return CTEST_ERROR;
+
+    if (fd) {
+        *fd = -1;
+
+        if ((cm = CMSG_FIRSTHDR(&msg)) && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    }
+
+    return CTEST_OK;
+}
+
+/**
+ * 死亡子进程: stderr写到errfd, stdout丢掉
+ */
+static inline void ctest_test_death_child(int errfd, int markfd, int target)
+{
+    int                     fd;
+
+    dup2(errfd, STDERR_FILENO);
+
+    if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    close(errfd);
+    ctest_test_death.fd = markfd;
+    ctest_test_death.target = target;
+    ctest_test_death.seq = 0;
+    ctest_test_jmp_set = 0;
+}
+
+/**
+ * zygote: 每个请求fork一个孙子进程, 从头跑测试, 到第target个death点执行语句
+ */
+static inline void ctest_test_zygote_loop(int sock)
+{
+    ctest_test_func_t        *t;
+    struct {
+        ctest_test_func_t    *func;
+        int                 target;
+    } req;
+    int                     res[2], errfd, mfd[2];
+    char                    mark;
+    pid_t                   pid;
+
+    while(ctest_test_death_recv(sock, &req, sizeof(req), &errfd) == CTEST_OK) {
+        res[0] = -1;
+        res[1] = 0;
+
+        if (errfd >= 0 && pipe(mfd) == 0) {
+            if ((pid = fork()) == 0) {
+                close(sock);
+                close(mfd[0]);
+                ctest_test_death_child(errfd, mfd[1], req.target);
+                t = req.func;
+
+                if (t->tc->fcsetup) (*t->tc->fcsetup)();
+
+                if (t->tc->fsetup) (*t->tc->fsetup)();
+
+                (t->func)();
+                mark = CTEST_TEST_DEATH_MISS;
+
+                if (write(mfd[1], &mark, 1) != 1) _exit(1);
+
+                _exit(0);
+            }
+
+            close(mfd[1]);
+
+            if (pid > 0 && waitpid(pid, &res[0], 0) == pid && read(mfd[0], &mark, 1) == 1)
+                res[1] = mark;
+
+            close(mfd[0]);
+        }
+
+        if (errfd >= 0) close(errfd);
+
+        if (ctest_test_death_send(sock, res, sizeof(res), -1) != CTEST_OK)
+            break;
+    }
+
+    _exit(0);
+}
+
+static inline void ctest_test_zygote_start()
+{
+    int                     sv[2];
+    pid_t                   pid;
+
+    ctest_test_death.zygote_fd = -1;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0)
+        return;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) == 0) {
+        close(sv[0]);
+        ctest_test_zygote_loop(sv[1]);
+    }
+
+    close(sv[1]);
+
+    if (pid < 0) {
+        close(sv[0]);
+        return;
+    }
+
+    ctest_test_death.zygote_fd = sv[0];
+    ctest_test_death.zygote_pid = pid;
+}
+
+static inline void ctest_test_zygote_stop()
+{
+    if (ctest_test_death.zygote_fd < 0)
+        return;
+
+    close(ctest_test_death.zygote_fd);
+    waitpid(ctest_test_death.zygote_pid, NULL, 0);
+    ctest_test_death.zygote_fd = -1;
+}
+
+/**
+ * 返回1: 在子进程里, 执行语句; 0: 已经在子进程里跑完, 检查结果; -1: 子进程里别的death点, 跳过
+ */
+static inline int ctest_test_death_begin()
+{
+    struct {
+        ctest_test_func_t    *func;
+        int                 target;
+    } req;
+    int                     res[2], efd[2], mfd[2], n, seq;
+    char                    mark, drain[4096];
+    pid_t                   pid;
+
+    seq = ++ ctest_test_death.seq;
+
+    if (ctest_test_death.target)
+        return (seq == ctest_test_death.target || ctest_test_death.target < 0 ? 1 : -1);
+
+    ctest_test_death.len = 0;
+    ctest_test_death.err[0] = '\0';
+    ctest_test_death.status = -1;
+    ctest_test_death.flag = CTEST_TEST_DEATH_MISS;
+
+    if (pipe(efd) != 0)
+        return 0;
+
+    res[1] = CTEST_TEST_DEATH_MISS;
+
+    // zygote重跑到这里
+    if (ctest_test_death.zygote_fd >= 0) {
+        req.func = ctest_test_death.func;
+        req.target = seq;
+
+        if (ctest_test_death_send(ctest_test_death.zygote_fd, &req, sizeof(req), efd[1]) != CTEST_OK)
+            ctest_test_zygote_stop();
+    }
+
+    if (ctest_test_death.zygote_fd >= 0) {
+        close(efd[1]);
+        pid = 0;
+    } else if (pipe(mfd) != 0) {
+        close(efd[0]);
+        close(efd[1]);
+        return 0;
+    } else {
+        // 没有zygote, 直接fork
+        fflush(stdout);
+        fflush(stderr);
+
+        if ((pid = fork()) == 0) {
+            close(efd[0]);
+            close(mfd[0]);
+            ctest_test_death_child(efd[1], mfd[1], -1);
+            return 1;
+        }
+
+        close(efd[1]);
+        close(mfd[1]);
+    }
+
+    // 满了以后接着读掉, 不然子进程写stderr会因为SIGPIPE死掉
+    for(;;) {
+        if (ctest_test_death.len < CTEST_TEST_DEATH_ERR - 1)
+            n = read(efd[0], ctest_test_death.err + ctest_test_death.len,
+                     CTEST_TEST_DEATH_ERR - 1 - ctest_test_death.len);
+        else
+            n = read(efd[0], drain, sizeof(drain));
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0) break;
+
+        if (ctest_test_death.len < CTEST_TEST_DEATH_ERR - 1)
+            ctest_test_death.len += n;
+    }
+
+    ctest_test_death.err[ctest_test_death.len] = '\0';
+    close(efd[0]);
+
+    if (pid > 0) {
+        if (waitpid(pid, &res[0], 0) != pid)
+            res[0] = -1;
+
+        res[1] = (read(mfd[0], &mark, 1) == 1 ? mark : 0);
+        close(mfd[0]);
+    } else if (pid == 0 && ctest_test_death_recv(ctest_test_death.zygote_fd, res, sizeof(res), NULL) != CTEST_OK) {
+        ctest_test_zygote_stop();
+        res[0] = -1;
+    }
+
+    ctest_test_death.status = res[0];
+    ctest_test_death.flag = res[1];
+    return 0;
+}
+
+// 子进程里语句执行完还活着
+static inline void ctest_test_death_returned()
+{
+    char                    mark = CTEST_TEST_DEATH_RET;
+
+    fflush(stderr);
+
+    if (write(ctest_test_death.fd, &mark, 1) != 1)
+        _exit(1);
+
+    _exit(0);
+}
+
+/**
+ * code < 0: EXPECT_DEATH, 不是正常exit(0)并且stderr匹配regex; 否则EXPECT_EXIT, exit(code)
+ */
+static inline void ctest_test_death_check(ctest_test_site_t *site, const char *expr, const char *regex, int code)
+{
+    regex_t                 re;
+    int                     st = ctest_test_death.status;
+    char                    how[64];
+
+    if (ctest_test_death.flag == CTEST_TEST_DEATH_MISS || st == -1) {
+        ctest_test_site_fail(site, expr, " child did not reach the statement");
+        return;
+    }
+
+    how[0] = '\0';
+
+    if (ctest_test_death.flag == CTEST_TEST_DEATH_RET) {
+        lnprintf(how, sizeof(how), "statement returned");
+    } else if (WIFEXITED(st)) {
+        if (code >= 0 && WEXITSTATUS(st) == code)
+            return;
+
+        if (code >= 0 || WEXITSTATUS(st) == 0)
+            lnprintf(how, sizeof(how), "exited with %d", WEXITSTATUS(st));
+    } else if (code >= 0) {
+        lnprintf(how, sizeof(how), "killed by signal %d", WTERMSIG(st));
+    }
+
+    if (how[0]) {
+        ctest_test_site_fail(site, expr, " %s%s%s", how,
+                             (ctest_test_death.len ? ", stderr:\n" : ""), ctest_test_death.err);
+        return;
+    }
+
+    if (regcomp(&re, regex, REG_EXTENDED | REG_NOSUB) != 0) {
+        ctest_test_site_fail(site, expr, " bad regex \"%s\"", regex);
+        return;
+    }
+
+    if (regexec(&re, ctest_test_death.err, 0, NULL, 0) != 0)
+        ctest_test_site_fail(site, expr, " stderr doesn't match \"%s\":\n%s", regex, ctest_test_death.err);
+
+    regfree(&re);
 }
 
 static inline void ctest_test_print_usage(char *prog_name)
@@ -126,6 +833,20 @@ static inline void ctest_test_print_usage(char *prog_name)
     fprintf(stderr, "%s [-f [-]filter_string]\n"
             "    -f, --filter            filter string\n"
             "    -l, --list              list tests\n"
+            "        --profile[=dir]     sample each test, write dir/case.test.folded\n"
+            "        --trace=file        write chrome trace-event json\n"
+            "        --site-limit=N      failures printed per assertion, 0 = all\n"
+            "        --update-golden     rewrite golden files of EXPECT_FILE_EQ\n"
+            "        --prop-cases=N      cases generated per TEST_PROP\n"
+            "        --prop-jobs=N       fork N processes to generate cases\n"
+            "        --prop-seed=S       replay one failing TEST_PROP seed\n"
+            "        --bench-rounds=N    interleaved rounds of BENCH_COMPARE\n"
+            "        --bench-csv=file    append BENCH_RANGE timings as csv\n"
+            "        --load=lib.so       dlopen a shared object and run its tests too\n"
+            "        --serve=sock        stay resident, run tests for ctest-runner --connect\n"
+            "        --death-fork        fork death tests in place instead of using the zygote\n"
+            "        --mem-limit=N[KMG]  fail a test whose memory peak exceeds N bytes\n"
+            "        --mem-stats         print the memory peak of each test\n"
             "    -h, --help              display this help and exit\n"
             "    -V, --version           version and build time\n\n", prog_name);
 }
@@ -172,40 +893,131 @@ static inline int ctest_test_is_skip(const char *str, cmdline_param_t *cp)
 static inline int ctest_test_parse_cmd_line(int argc, char *const argv[], cmdline_param_t *cp)
 {
     int                     opt, len;
+    char                    *end;
     const char              *opt_string = "hVf:l";
     struct option           long_opts[] = {
         {"filter", 1, NULL, 'f'},
         {"list", 0, NULL, 'l'},
+        {"profile", 2, NULL, 'P'},
+        {"trace", 1, NULL, 'T'},
+        {"site-limit", 1, NULL, 'S'},
+        {"update-golden", 0, NULL, 'G'},
+        {"prop-cases", 1, NULL, 'N'},
+        {"prop-jobs", 1, NULL, 'J'},
+        {"prop-seed", 1, NULL, 'R'},
+        {"bench-rounds", 1, NULL, 'B'},
+        {"bench-csv", 1, NULL, 'C'},
+        {"load", 1, NULL, 'L'},
+        {"serve", 1, NULL, 'D'},
+        {"death-fork", 0, NULL, 'Z'},
+        {"mem-limit", 1, NULL, 'M'},
+        {"mem-stats", 0, NULL, 'm'},
         {"help", 0, NULL, 'h'},
         {"version", 0, NULL, 'V'},
         {0, 0, 0, 0}
     };
 
-    opterr = 0;
+    opterr = 0;
+
+    while ((opt = getopt_long(argc, argv, opt_string, long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+
+            if (*optarg == '-') {
+                cp->filter_flags = 1;
+                cp->filter_str = optarg + 1;
+            } else {
+                cp->filter_str = optarg;
+            }
+
+            len = strlen(cp->filter_str);
+
+            if (len > 0 && (cp->filter_str[len - 1] == '*' || cp->filter_str[len - 1] == '?'))
+                cp->filter_str_len = len - 1;
+            else
+                cp->filter_str_len = -1;
+
+            break;
+
+        case 'P':
+            cp->profile_dir = (optarg ? optarg : ".");
+            break;
+
+        case 'T':
+            cp->trace_file = optarg;
+            break;
+
+        case 'S':
+            cp->site_limit = atoi(optarg);
+            break;
+
+        case 'G':
+            cp->update_golden = 1;
+            break;
+
+        case 'N':
+            cp->prop_cases = atoi(optarg);
+            break;
+
+        case 'J':
+            cp->prop_jobs = atoi(optarg);
+            break;
+
+        case 'R':
+            cp->prop_seed = strtoull(optarg, NULL, 0);
+            break;
 
-    while ((opt = getopt_long(argc, argv, opt_string, long_opts, NULL)) != -1) {
-        switch (opt) {
-        case 'f':
+        case 'B':
+            cp->bench_rounds = atoi(optarg);
+            break;
 
-            if (*optarg == '-') {
-                cp->filter_flags = 1;
-                cp->filter_str = optarg + 1;
-            } else {
-                cp->filter_str = optarg;
+        case 'C':
+            cp->bench_csv = optarg;
+            break;
+
+        case 'L':
+            if (cp->load_cnt == CTEST_TEST_MAX_LOAD) {
+                fprintf(stderr, "too many --load, max %d\n", CTEST_TEST_MAX_LOAD);
+                return CTEST_ERROR;
             }
 
-            len = strlen(cp->filter_str);
+            cp->load[cp->load_cnt++] = optarg;
+            break;
 
-            if (len > 0 && (cp->filter_str[len - 1] == '*' || cp->filter_str[len - 1] == '?'))
-                cp->filter_str_len = len - 1;
-            else
-                cp->filter_str_len = -1;
+        case 'l':
+            cp->list = 1;
+            break;
 
+        case 'D':
+            cp->serve_path = optarg;
             break;
 
-        case 'l':
-            ctest_test_print_list();
-            return CTEST_ERROR;
+        case 'Z':
+            cp->death_fork = 1;
+            break;
+
+        case 'M':
+            cp->mem_limit = strtoll(optarg, &end, 10);
+
+            switch(*end) {
+            case 'g':
+            case 'G':
+                cp->mem_limit <<= 10;
+
+            case 'm':
+            case 'M':
+                cp->mem_limit <<= 10;
+
+            case 'k':
+            case 'K':
+                cp->mem_limit <<= 10;
+            }
+
+            break;
+
+        case 'm':
+            cp->mem_stats = 1;
+            break;
 
         case 'V':
             fprintf(stderr, "BUILD_TIME: %s %s\n", __DATE__, __TIME__);
@@ -221,22 +1033,51 @@ static inline int ctest_test_parse_cmd_line(int argc, char *const argv[], cmdlin
     return CTEST_OK;
 }
 
+/**
+ * dlopen --load的共享库, 库里TEST的constructor注册到ctest_test_case_list;
+ * 主程序需要用-rdynamic链接, 库才能找到这些全局变量
+ */
+static inline int ctest_test_load(cmdline_param_t *cp)
+{
+    int                     i;
+
+    for(i = 0; i < cp->load_cnt; i++) {
+        if (dlopen(cp->load[i], RTLD_NOW | RTLD_GLOBAL) == NULL) {
+            fprintf(stderr, "load %s: %s\n", cp->load[i], dlerror());
+            return CTEST_ERROR;
+        }
+    }
+
+    return CTEST_OK;
+}
+
+// 头留16字节, 返回的内存和malloc一样16字节对齐
 static inline void *ctest_test_realloc (void *ptr, size_t size)
 {
     char                    *p1, *p = (char *)ptr;
 
     if (p) {
-        p -= 8;
+        p -= 16;
         ctest_atomic_add(&ctest_test_alloc_byte, -(*((int *)p)));
+#ifndef CTEST_TEST_MALLOC_HOOK
+
+        if (ctest_test_mem_track) ctest_test_mem_add(-(*((int *)p)));
+
+#endif
     }
 
     if (size) {
         ctest_atomic_add(&ctest_test_alloc_byte, size);
-        p1 = (char *)ctest_realloc(p, size + 8);
+#ifndef CTEST_TEST_MALLOC_HOOK
+
+        if (ctest_test_mem_track) ctest_test_mem_add(size);
+
+#endif
+        p1 = (char *)ctest_realloc(p, size + 16);
 
         if (p1) {
             *((int *)p1) = size;
-            p1 += 8;
+            p1 += 16;
         }
 
         return p1;
@@ -247,16 +1088,22 @@ static inline void *ctest_test_realloc (void *ptr, size_t size)
     return NULL;
 }
 
-static int ctest_test_exec_case(ctest_test_case_t *tc)
+static int ctest_test_exec_case(ctest_test_case_t *tc, cmdline_param_t *cp)
 {
     ctest_test_func_t        *t;
-    int64_t                 t1, t2;
+    int64_t                 t1, t2, s1, s2, c1, peak;
     int                     failcnt = 0;
+    char                    profile_name[512], peak_str[32];
 
     ctest_test_color_printf(CTEST_TEST_COLOR_GREEN, "[----------]");
     printf(" %d tests from %s\n", tc->list_cnt, tc->case_name);
 
-    if (tc->fcsetup) (*tc->fcsetup)();
+    c1 = s1 = ctest_trace_now();
+
+    if (tc->fcsetup) {
+        (*tc->fcsetup)();
+        ctest_trace_span("setup", s1, ctest_trace_now(), "%s.case_setup", tc->case_name);
+    }
 
     ctest_list_for_each_entry(t, &tc->list, listnode) {
         // start run
@@ -264,15 +1111,59 @@ static int ctest_test_exec_case(ctest_test_case_t *tc)
         printf(" %s.%s\n", tc->case_name, t->func_name);
 
         ctest_test_retval = 0;
+        ctest_test_seq ++;
+        ctest_test_death.func = t;
+        ctest_test_death.seq = 0;
+        ctest_test_mem_peak = ctest_test_mem_base = ctest_test_mem_cur;
+        ctest_test_mem_over = 0;
+        ctest_test_mem_limit = (t->mem_limit ? t->mem_limit : cp->mem_limit);
         t1 = ctest_test_now();
+        s1 = ctest_trace_now();
+
+        if (cp->profile_dir) ctest_profile_start();
+
+        if (setjmp(ctest_test_jmp) == 0) {
+            ctest_test_jmp_set = 1;
 
-        if (tc->fsetup) (*tc->fsetup)();
+            if (tc->fsetup) {
+                (*tc->fsetup)();
+                ctest_trace_span("setup", s1, ctest_trace_now(), "setup");
+            }
+
+            (t->func)();
+        }
 
-        (t->func)();
+        ctest_test_jmp_set = 0;
 
-        if (tc->fdown) (*tc->fdown)();
+        if (tc->fdown) {
+            s2 = ctest_trace_now();
+            (*tc->fdown)();
+            ctest_trace_span("teardown", s2, ctest_trace_now(), "teardown");
+        }
 
         t2 = ctest_test_now();
+        peak = ctest_test_mem_peak - ctest_test_mem_base;
+        ctest_test_mem_limit = 0;
+        ctest_trace_span("test", s1, ctest_trace_now(), "%s.%s", tc->case_name, t->func_name);
+
+        if (ctest_test_mem_track)
+            ctest_trace_counter("memory", s1, peak, "%s.%s peak", tc->case_name, t->func_name);
+
+        if (cp->profile_dir) {
+            ctest_profile_stop();
+            snprintf(profile_name, sizeof(profile_name), "%s/%s.%s.folded",
+                     cp->profile_dir, tc->case_name, t->func_name);
+
+            if (ctest_profile_dump(profile_name) != CTEST_OK)
+                fprintf(stderr, "profile: can't write %s\n", profile_name);
+        }
+
+        ctest_test_site_summary();
+
+        if (ctest_test_mem_over)
+            printf("ERROR memory peak %" PRId64 " bytes, limit %" PRId64 "\n", peak,
+                   (t->mem_limit ? t->mem_limit : cp->mem_limit));
+
         t->ret = ctest_test_retval;
 
         // failure
@@ -283,16 +1174,29 @@ static int ctest_test_exec_case(ctest_test_case_t *tc)
             ctest_test_color_printf(CTEST_TEST_COLOR_GREEN, "[       OK ]");
         }
 
-        printf(" %s.%s (%d ms)\n", tc->case_name, t->func_name, (int)(t2 - t1));
+        if (ctest_test_mem_track && peak < 1024)
+            printf(" %s.%s (%d ms, peak %d B)\n", tc->case_name, t->func_name, (int)(t2 - t1), (int)peak);
+        else if (ctest_test_mem_track)
+            printf(" %s.%s (%d ms, peak %s)\n", tc->case_name, t->func_name, (int)(t2 - t1),
+                   ctest_string_format_size(peak, peak_str, sizeof(peak_str)));
+        else
+            printf(" %s.%s (%d ms)\n", tc->case_name, t->func_name, (int)(t2 - t1));
+    }
+
+    if (tc->fcdown) {
+        s2 = ctest_trace_now();
+        (*tc->fcdown)();
+        ctest_trace_span("teardown", s2, ctest_trace_now(), "%s.case_teardown", tc->case_name);
     }
 
-    if (tc->fcdown) (*tc->fcdown)();
+    ctest_trace_span("case", c1, ctest_trace_now(), "%s", tc->case_name);
 
     ctest_test_color_printf(CTEST_TEST_COLOR_GREEN, "[----------]");
     printf(" %d tests from %s\n\n", tc->list_cnt, tc->case_name);
     return failcnt;
 }
 
+static inline int ctest_test_serve(cmdline_param_t *cp, char *argv[]);
 static inline int ctest_test_main(int argc, char *argv[])
 {
     ctest_test_case_t        *tc, *tc1;
@@ -304,11 +1208,55 @@ static inline int ctest_test_main(int argc, char *argv[])
 
     // parse cmd
     memset(&cp, 0, sizeof(cmdline_param_t));
+    cp.site_limit = CTEST_TEST_SITE_LIMIT;
 
     if (ctest_test_parse_cmd_line(argc, argv, &cp) == CTEST_ERROR) {
         return -1;
     }
 
+    if (ctest_test_load(&cp) == CTEST_ERROR) {
+        return -1;
+    }
+
+    // 只有TEST_MEM_LIMIT没有TEST的; 有预算或者--mem-stats时才统计内存
+    ctest_test_mem_track = (cp.mem_limit > 0 || cp.mem_stats);
+
+    ctest_list_for_each_entry(tc, &ctest_test_case_list, listnode) {
+        ctest_list_for_each_entry_safe(t, nt, &tc->list, listnode) {
+            if (t->func) {
+                if (t->mem_limit) ctest_test_mem_track = 1;
+
+                continue;
+            }
+
+            fprintf(stderr, "TEST_MEM_LIMIT(%s, %s) has no TEST\n", tc->case_name, t->func_name);
+            ctest_list_del(&t->listnode);
+            tc->list_cnt --;
+        }
+    }
+
+    if (cp.list) {
+        ctest_test_print_list();
+        return -1;
+    }
+
+    if (cp.serve_path) {
+        return ctest_test_serve(&cp, argv);
+    }
+
+    ctest_test_site_limit = cp.site_limit;
+    ctest_test_update_golden = cp.update_golden;
+
+    if (cp.prop_cases > 0) ctest_prop_cases = cp.prop_cases;
+
+    if (cp.prop_jobs > 0) ctest_prop_jobs = cp.prop_jobs;
+
+    ctest_prop_seed = cp.prop_seed;
+
+    if (cp.bench_rounds > 0) ctest_bench_rounds = cp.bench_rounds;
+
+    ctest_bench_csv = cp.bench_csv;
+
     // init
     ctest_test_color_printf(CTEST_TEST_COLOR_GREEN, "[==========]");
 
@@ -338,12 +1286,32 @@ static inline int ctest_test_main(int argc, char *argv[])
 
     printf(" Running %d tests from %d cases.\n", total_func_cnt, total_case_cnt);
 
+    if (cp.profile_dir && ctest_profile_init(CTEST_PROFILE_DEFAULT_HZ) != CTEST_OK) {
+        fprintf(stderr, "profile: init failed\n");
+        cp.profile_dir = NULL;
+    }
+
+    // ctest-runner给每个测试进程一个单独的文件
+    if (cp.trace_file == NULL) cp.trace_file = getenv(CTEST_TRACE_FILE_ENV);
+
+    if (cp.trace_file) ctest_trace_open(cp.trace_file);
+
+    ctest_test_death.zygote_fd = -1;
+
+    if (!cp.death_fork) ctest_test_zygote_start();
+
     t1 = ctest_test_now();
     ctest_pool_set_allocator(ctest_test_realloc);
     ctest_list_for_each_entry(tc, &ctest_test_case_list, listnode) {
-        total_failcnt += ctest_test_exec_case(tc);
+        total_failcnt += ctest_test_exec_case(tc, &cp);
     }
     t2 = ctest_test_now();
+    ctest_test_zygote_stop();
+
+    if (cp.profile_dir) ctest_profile_destroy();
+
+    if (cp.trace_file && ctest_trace_close() != CTEST_OK)
+        fprintf(stderr, "trace: can't write %s\n", cp.trace_file);
 
     ctest_test_color_printf(CTEST_TEST_COLOR_GREEN, "[==========]");
     printf(" %d tests ran. (%d ms total)\n", total_func_cnt, (int)(t2 - t1));
@@ -372,9 +1340,216 @@ static inline int ctest_test_main(int argc, char *argv[])
     return (total_failcnt > 0 ? 1 : 0);
 }
 
+/**
+ * 一个请求: 参数以'\0'分隔, 空参数结束; fork子进程跑ctest_test_main, 输出直接写到连接上,
+ * 最后写'\0'和退出码. 常驻时的参数(去掉--serve)放在前面, 同一个选项以请求里的为准
+ */
+static inline void ctest_test_serve_request(int conn, char *serve_argv[])
+{
+    char                    buffer[4096], *argv[256], trailer[2];
+    int                     i, n, len, argc, status;
+    pid_t                   pid;
+
+    len = 0;
+
+    while(len < 2 || buffer[len - 1] || buffer[len - 2]) {
+        if (len == sizeof(buffer) || (n = read(conn, buffer + len, sizeof(buffer) - len)) <= 0)
+            return;
+
+        len += n;
+
+        if (len == 1 && buffer[0] == '\0')
+            break;
+    }
+
+    for(i = argc = 0; serve_argv[i] && argc < 128; i++) {
+        if (i > 0 && strncmp(serve_argv[i], "--serve", 7) == 0) {
+            if (serve_argv[i][7] == '\0' && serve_argv[i + 1]) i++;
+
+            continue;
+        }
+
+        argv[argc++] = serve_argv[i];
+    }
+
+    for(n = 0; n < len && buffer[n] && argc < 255; n += strlen(buffer + n) + 1)
+        argv[argc++] = buffer + n;
+
+    argv[argc] = NULL;
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) == 0) {
+        dup2(conn, STDOUT_FILENO);
+        dup2(conn, STDERR_FILENO);
+        close(conn);
+        optind = 0;
+        exit(ctest_test_main(argc, argv));
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        status = -1;
+
+    trailer[0] = '\0';
+    trailer[1] = (status == -1 ? 127 : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+    if (write(conn, trailer, 2) != 2)
+        return;
+}
+
+/**
+ * --serve: 常驻在unix socket上, 每个请求fork一个子进程跑;
+ * 自己的程序文件变了(并且稳定了一个周期)以后re-exec
+ */
+static inline int ctest_test_serve(cmdline_param_t *cp, char *argv[])
+{
+    struct sockaddr_un      addr;
+    struct stat             st0, st, last;
+    struct pollfd           pfd;
+    char                    self[PATH_MAX];
+    int                     fd, conn, changed;
+    ssize_t                 n;
+
+    if ((n = readlink("/proc/self/exe", self, sizeof(self) - 1)) < 0 || stat(self, &st0) != 0) {
+        fprintf(stderr, "serve: can't find own binary\n");
+        return -1;
+    }
+
+    self[n] = '\0';
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ctest_strncpy(addr.sun_path, cp->serve_path, sizeof(addr.sun_path));
+
+    // 只删上次留下的socket, 别的文件不动
+    if (lstat(addr.sun_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "serve %s: exists and is not a socket\n", cp->serve_path);
+            return -1;
+        }
+
+        unlink(addr.sun_path);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+            || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "serve %s: %s\n", cp->serve_path, strerror(errno));
+        return -1;
+    }
+
+    printf("serving on %s\n", cp->serve_path);
+    fflush(stdout);
+    last = st0;
+    changed = 0;
+
+    for(;;) {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, 200) > 0 && (conn = accept(fd, NULL, NULL)) >= 0) {
+            ctest_test_serve_request(conn, argv);
+            close(conn);
+        }
+
+        if (stat(self, &st) != 0)
+            continue;
+
+        if (st.st_ino != st0.st_ino || st.st_mtime != st0.st_mtime || st.st_size != st0.st_size) {
+            if (changed && st.st_ino == last.st_ino && st.st_mtime == last.st_mtime && st.st_size == last.st_size)
+                break;
+
+            changed = 1;
+        }
+
+        last = st;
+    }
+
+    close(fd);
+    printf("%s changed, restarting\n", self);
+    fflush(stdout);
+    execv(self, argv);
+    fprintf(stderr, "exec %s: %s\n", self, strerror(errno));
+    return -1;
+}
+
+// 替换malloc, 统计每个测试的内存峰值; 编译时加-DCTEST_NO_MALLOC_HOOK关掉,
+// 没有TEST_MEM_LIMIT, --mem-limit和--mem-stats时只是转一下
+#ifdef CTEST_TEST_MALLOC_HOOK
+#ifdef __cplusplus
+#define CTEST_TEST_EXTERN_C extern "C"
+#define CTEST_TEST_NOTHROW  __THROW
+#else
+#define CTEST_TEST_EXTERN_C
+#define CTEST_TEST_NOTHROW
+#endif
+#define CTEST_TEST_MALLOC_DEFINE                                                        \
+    CTEST_TEST_EXTERN_C void *malloc(size_t size) CTEST_TEST_NOTHROW {                  \
+        void *p = __libc_malloc(size);                                                  \
+        if (ctest_test_mem_track && p) ctest_test_mem_add(malloc_usable_size(p));       \
+        return p;                                                                       \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void *calloc(size_t n, size_t size) CTEST_TEST_NOTHROW {        \
+        void *p = __libc_calloc(n, size);                                               \
+        if (ctest_test_mem_track && p) ctest_test_mem_add(malloc_usable_size(p));       \
+        return p;                                                                       \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void *realloc(void *ptr, size_t size) CTEST_TEST_NOTHROW {      \
+        int64_t old = (ctest_test_mem_track && ptr ? (int64_t)malloc_usable_size(ptr) : 0); \
+        void *p = __libc_realloc(ptr, size);                                            \
+        if (!ctest_test_mem_track) return p;                                            \
+        if (p) ctest_test_mem_add((int64_t)malloc_usable_size(p) - old);                \
+        else if (size == 0) ctest_test_mem_add(-old);                                   \
+        return p;                                                                       \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void *memalign(size_t align, size_t size) CTEST_TEST_NOTHROW {  \
+        void *p = __libc_memalign(align, size);                                         \
+        if (ctest_test_mem_track && p) ctest_test_mem_add(malloc_usable_size(p));       \
+        return p;                                                                       \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void *valloc(size_t size) CTEST_TEST_NOTHROW {                  \
+        void *p = __libc_valloc(size);                                                  \
+        if (ctest_test_mem_track && p) ctest_test_mem_add(malloc_usable_size(p));       \
+        return p;                                                                       \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void *pvalloc(size_t size) CTEST_TEST_NOTHROW {                 \
+        void *p = __libc_pvalloc(size);                                                 \
+        if (ctest_test_mem_track && p) ctest_test_mem_add(malloc_usable_size(p));       \
+        return p;                                                                       \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void *aligned_alloc(size_t align, size_t size) CTEST_TEST_NOTHROW { \
+        return memalign(align, size);                                                   \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C int posix_memalign(void **r, size_t align, size_t size) CTEST_TEST_NOTHROW { \
+        return ((*r = memalign(align, size)) ? 0 : ENOMEM);                             \
+    }                                                                                   \
+    CTEST_TEST_EXTERN_C void free(void *ptr) CTEST_TEST_NOTHROW {                       \
+        if (ctest_test_mem_track && ptr) ctest_test_mem_add(-(int64_t)malloc_usable_size(ptr)); \
+        __libc_free(ptr);                                                               \
+    }
+#else
+#define CTEST_TEST_MALLOC_DEFINE
+#endif
+
 #define CTEST_TEST_MAIN_DEFINE                                                           \
     int                     ctest_test_retval = 0;                                                           \
     ctest_atomic_t           ctest_test_alloc_byte = 0;                                             \
+    int                     ctest_test_seq = 0;                                                       \
+    int                     ctest_test_site_limit = CTEST_TEST_SITE_LIMIT;                            \
+    int                     ctest_test_update_golden = 0;                                             \
+    int                     ctest_test_quiet = 0;                                                     \
+    ctest_test_death_t       ctest_test_death;                                                         \
+    ctest_atomic_t           ctest_test_mem_cur = 0;                                                  \
+    ctest_atomic_t           ctest_test_mem_peak = 0;                                                 \
+    int64_t                 ctest_test_mem_base = 0;                                                  \
+    int64_t                 ctest_test_mem_limit = 0;                                                 \
+    int                     ctest_test_mem_over = 0;                                                  \
+    int                     ctest_test_mem_track = 0;                                                 \
+    CTEST_TEST_MALLOC_DEFINE                                                             \
+    ctest_test_site_t        *ctest_test_site_list = NULL;                                            \
+    ctest_atomic_t           ctest_test_site_lock = 0;                                                \
+    jmp_buf                 ctest_test_jmp;                                                           \
+    int                     ctest_test_jmp_set = 0;                                                   \
     ctest_pool_t             *ctest_test_pool = NULL;                                                 \
     ctest_hash_t             *ctest_test_case_table = NULL;                                           \
     ctest_list_t             ctest_test_case_list = CTEST_LIST_HEAD_INIT(ctest_test_case_list);         \
@@ -391,22 +1566,22 @@ static inline int ctest_test_main(int argc, char *argv[])
 
 #define TEST_NAME(case_name, func_name) ctest_testf_##case_name##_##func_name
 #define TEST_CASE(case_name, func_name) ctest_testc_##case_name##_##func_name
-// TEST
+// TEST, 函数都是static的, --load的库里和主程序重名的TEST不会互相顶掉
 #define TEST(case_name, func_name)                                                      \
-    void TEST_NAME(case_name, func_name)();                                             \
-    __attribute__((constructor)) void ctest_testg_##case_name##_##func_name() {          \
+    static void TEST_NAME(case_name, func_name)();                                      \
+    __attribute__((constructor)) static void ctest_testg_##case_name##_##func_name() {   \
         ctest_test_reg_func(#case_name, #func_name,                                      \
-                           TEST_NAME(case_name, func_name), 1);                         \
+                           CTEST_TEST_GUARD(TEST_NAME(case_name, func_name)), 1);       \
     }                                                                                   \
-    void TEST_NAME(case_name, func_name)()
+    static void TEST_NAME(case_name, func_name)()
 
 #define TEST_SETUP_DOWN(case_name, func_name)                                           \
-    void TEST_CASE(case_name, func_name)();                                             \
-    __attribute__((constructor)) void ctest_testd_##case_name##_##func_name() {          \
+    static void TEST_CASE(case_name, func_name)();                                      \
+    __attribute__((constructor)) static void ctest_testd_##case_name##_##func_name() {   \
         ctest_test_case_t        *tc = ctest_test_get_tc(#case_name);                            \
-        tc->f##func_name = TEST_CASE(case_name, func_name);                             \
+        tc->f##func_name = CTEST_TEST_GUARD(TEST_CASE(case_name, func_name));           \
     }                                                                                   \
-    void TEST_CASE(case_name, func_name)()
+    static void TEST_CASE(case_name, func_name)()
 
 #define TEST_CASE_SETUP(case_name) TEST_SETUP_DOWN(case_name, csetup)
 #define TEST_CASE_DOWN(case_name) TEST_SETUP_DOWN(case_name, cdown)
@@ -414,86 +1589,379 @@ static inline int ctest_test_main(int argc, char *argv[])
 #define TEST_SETUP(case_name) TEST_SETUP_DOWN(case_name, setup)
 #define TEST_DOWN(case_name) TEST_SETUP_DOWN(case_name, down)
 
+// TEST_PROP, 函数体里用PROP_*生成输入, 失败时自动缩小
+#define TEST_PROP(case_name, func_name)                                                 \
+    static void ctest_prop_##case_name##_##func_name(ctest_prop_t *prop);              \
+    TEST(case_name, func_name) {                                                        \
+        ctest_test_prop_run(#case_name "." #func_name,                                  \
+                            ctest_prop_##case_name##_##func_name);                      \
+    }                                                                                   \
+    static void ctest_prop_##case_name##_##func_name(ctest_prop_t *prop)
+
+#define PROP_INT(lo, hi)              ctest_prop_int(prop, (lo), (hi))
+#define PROP_BYTES(min, max, len)     ctest_prop_bytes(prop, (min), (max), (len))
+#define PROP_STRING(max)              ctest_prop_string(prop, (max))
+#define PROP_ARRAY(lo, hi, max, n)    ctest_prop_array(prop, (lo), (hi), (max), (n))
+
+// BENCH_COMPARE, a和b是void fn(int64_t n), 交替运行比较快慢
+#define BENCH_COMPARE(case_name, func_name, a, b)                                       \
+    TEST(case_name, func_name) {                                                        \
+        if (ctest_bench_compare(#case_name "." #func_name, #a, a, #b, b) != CTEST_OK)   \
+            ctest_test_retval = 1;                                                      \
+    }
+
+// BENCH_RANGE, 函数体里有n和size两个参数, 规模从lo按multiplier增长到hi, 拟合复杂度
+#define BENCH_RANGE(case_name, func_name, lo, hi, multiplier)                           \
+    static void ctest_bench_##case_name##_##func_name(int64_t n, int64_t size);        \
+    TEST(case_name, func_name) {                                                        \
+        if (ctest_bench_range(#case_name "." #func_name,                                \
+                              ctest_bench_##case_name##_##func_name,                    \
+                              lo, hi, multiplier) != CTEST_OK)                          \
+            ctest_test_retval = 1;                                                      \
+    }                                                                                   \
+    static void ctest_bench_##case_name##_##func_name(int64_t n, int64_t size)
+
+// TEST_MEM_LIMIT, 测试的内存峰值不能超过bytes
+#define TEST_MEM_LIMIT(case_name, func_name, bytes)                                     \
+    __attribute__((constructor)) static void ctest_testm_##case_name##_##func_name() {   \
+        ctest_test_get_func(#case_name, #func_name)->mem_limit = (bytes);               \
+    }
+
+// 每个调用点一个static的ctest_test_site_t
+#define CTEST_TEST_SITE_FAIL(expr, fmt, args...) {                                     \
+        static ctest_test_site_t ctest_test_site = {__FILE__, __LINE__};                  \
+        ctest_test_site_fail(&ctest_test_site, expr, fmt, ## args);}
+
 // TEST_FAIL
 #define TEST_FAIL(fmt, args...)                                                         \
-    printf("ERROR at %s:%d, TEST_FAIL: " fmt "\n",                                  \
-           __FILE__, __LINE__, ## args); ctest_test_retval = 1;
+    CTEST_TEST_SITE_FAIL("TEST_FAIL: ", fmt, ## args)
 
 // EXPECT_TRUE
 #define EXPECT_TRUE(c) if(!(c)) {                                                       \
-        printf("ERROR at %s:%d, EXPECT_TRUE(" #c ")\n",                                 \
-               __FILE__, __LINE__); ctest_test_retval = 1;}
+        CTEST_TEST_SITE_FAIL("EXPECT_TRUE(" #c ")", "%s", "");}
 
 // EXPECT_FALSE
 #define EXPECT_FALSE(c) if((c)) {                                                       \
-        printf("ERROR at %s:%d, EXPECT_FALSE(" #c ")\n",                                \
-               __FILE__, __LINE__); ctest_test_retval = 1;}
+        CTEST_TEST_SITE_FAIL("EXPECT_FALSE(" #c ")", "%s", "");}
+
+// EXPECT_MEM_EQ, 输出第一个不同位置附近的hex
+#define EXPECT_MEM_EQ(a, b, len) {                                                      \
+        static ctest_test_site_t ctest_test_site = {__FILE__, __LINE__};                  \
+        ctest_test_mem_eq(&ctest_test_site, "EXPECT_MEM_EQ(" #a ", " #b ", " #len ")",   \
+                          (a), (len), (b), (len));}
+
+// EXPECT_FILE_EQ, 和golden文件比较
+#define EXPECT_FILE_EQ(buf, len, filename) {                                            \
+        static ctest_test_site_t ctest_test_site = {__FILE__, __LINE__};                  \
+        ctest_test_file_eq(&ctest_test_site, "EXPECT_FILE_EQ(" #buf ", " #len ", " #filename ")", \
+                           (buf), (len), (filename));}
+
+// EXPECT_DEATH, 语句在子进程里执行, 要求进程异常结束并且stderr匹配regex
+#define CTEST_TEST_DEATH(stmt, expr, regex, code) {                                     \
+        static ctest_test_site_t ctest_test_site = {__FILE__, __LINE__};                  \
+        int ctest_test_death_ret = ctest_test_death_begin();                            \
+        if (ctest_test_death_ret > 0) { stmt; ctest_test_death_returned(); }            \
+        else if (ctest_test_death_ret == 0)                                             \
+            ctest_test_death_check(&ctest_test_site, expr, regex, code);}
+
+#define EXPECT_DEATH(stmt, regex)                                                       \
+    CTEST_TEST_DEATH(stmt, "EXPECT_DEATH(" #stmt ", " #regex ")", regex, -1)
+
+// EXPECT_EXIT, 要求exit(status)
+#define EXPECT_EXIT(stmt, status)                                                       \
+    CTEST_TEST_DEATH(stmt, "EXPECT_EXIT(" #stmt ", " #status ")", "", status)
+
+// ASSERT_*, 失败时结束当前测试
+#define ASSERT_TRUE(c) if(!(c)) {                                                       \
+        CTEST_TEST_SITE_FAIL("ASSERT_TRUE(" #c ")", "%s", ""); ctest_test_abort();}
+
+#define ASSERT_FALSE(c) if((c)) {                                                       \
+        CTEST_TEST_SITE_FAIL("ASSERT_FALSE(" #c ")", "%s", ""); ctest_test_abort();}
 
 CTEST_CPP_END
 
 #ifndef __cplusplus
 // EXPECT_EQ
 #define EXPECT_EQ(a, b) if(!((int64_t)(a)==(int64_t)(b))) {                                 \
-        printf("ERROR at %s: %d, EXPECT_EQ(" #a ", " #b ") (a=%" PRId64 ",b=%" PRId64 ")\n",\
-               __FILE__, __LINE__, (int64_t)(a), (int64_t)(b)); ctest_test_retval = 1;}
+        CTEST_TEST_SITE_FAIL("EXPECT_EQ(" #a ", " #b ")", " (a=%" PRId64 ",b=%" PRId64 ")",  \
+                            (int64_t)(a), (int64_t)(b));}
 
 // EXPECT_NE
 #define EXPECT_NE(a, b) if(((int64_t)(a)==(int64_t)(b))) {                                  \
-        printf("ERROR at %s: %d, EXPECT_NE(" #a ", " #b ") (a=%" PRId64 ",b=%" PRId64 ")\n",\
-               __FILE__, __LINE__, (int64_t)(a), (int64_t)(b)); ctest_test_retval = 1;}
+        CTEST_TEST_SITE_FAIL("EXPECT_NE(" #a ", " #b ")", " (a=%" PRId64 ",b=%" PRId64 ")",  \
+                            (int64_t)(a), (int64_t)(b));}
+
+#define ASSERT_EQ(a, b) if(!((int64_t)(a)==(int64_t)(b))) {                                 \
+        CTEST_TEST_SITE_FAIL("ASSERT_EQ(" #a ", " #b ")", " (a=%" PRId64 ",b=%" PRId64 ")",  \
+                            (int64_t)(a), (int64_t)(b)); ctest_test_abort();}
+
+#define ASSERT_NE(a, b) if(((int64_t)(a)==(int64_t)(b))) {                                  \
+        CTEST_TEST_SITE_FAIL("ASSERT_NE(" #a ", " #b ")", " (a=%" PRId64 ",b=%" PRId64 ")",  \
+                            (int64_t)(a), (int64_t)(b)); ctest_test_abort();}
 
 #else
 
 #include <string>
-#define CTEST_STRINGIFY(x) #x
-#define CTEST_TOSTRING(x) CTEST_STRINGIFY(x)
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#define CTEST_TEST_SITE_EQ(name, a, b, neq)                                                \
+    static ctest_test_site_t ctest_test_site = {__FILE__, __LINE__};                          \
+    if (!EXPECT_CTEST_EQ(&ctest_test_site, name "(" #a ", " #b ")", (a), (b), neq))
 
 // EXPECT_EQ
-#define EXPECT_EQ(a, b)                                                                     \
-    EXPECT_CTEST_EQ(__FILE__ ":" CTEST_TOSTRING(__LINE__) ", EXPECT_EQ(" #a ", " #b ")",  \
-                   (a), (b), false)
+#define EXPECT_EQ(a, b) do { CTEST_TEST_SITE_EQ("EXPECT_EQ", a, b, false); } while(0)
 
 // EXPECT_NE
-#define EXPECT_NE(a, b)                                                                     \
-    EXPECT_CTEST_EQ(__FILE__ ":" CTEST_TOSTRING(__LINE__) ", EXPECT_NE(" #a ", " #b ")",  \
-                   (a), (b), true)
+#define EXPECT_NE(a, b) do { CTEST_TEST_SITE_EQ("EXPECT_NE", a, b, true); } while(0)
 
-template <typename A, typename B>
-static inline void EXPECT_CTEST_EQ(const char *location, const A &a, const B &b, bool neq)
-{
-    if (!((int64_t)(a) == (int64_t)(b)) ^ neq) {
-        printf("ERROR at %s (a=%" PRId64 ",b=%" PRId64 ")\n",
-               location, (int64_t)(a), (int64_t)(b));
-        ctest_test_retval = 1;
+#define ASSERT_EQ(a, b) do { CTEST_TEST_SITE_EQ("ASSERT_EQ", a, b, false) ctest_test_abort(); } while(0)
+
+#define ASSERT_NE(a, b) do { CTEST_TEST_SITE_EQ("ASSERT_NE", a, b, true) ctest_test_abort(); } while(0)
+
+/**
+ * 比较时不分配内存, 保留原来的类型(double, uint64_t), 只有失败时才格式化
+ */
+namespace ctest_test_cmp {
+
+#if __cplusplus >= 201703L
+typedef std::string_view str_view;
+#else
+struct str_view {
+    const char              *ptr;
+    size_t                  len;
+    str_view(const char *p, size_t n) : ptr(p), len(n) {}
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+    bool operator==(const str_view &o) const
+    {
+        return len == o.len && memcmp(ptr, o.ptr, len) == 0;
     }
+};
+#endif
+
+enum {CTEST_CMP_STR, CTEST_CMP_INT, CTEST_CMP_FLOAT, CTEST_CMP_PTR, CTEST_CMP_OTHER};
+
+template <typename T> struct is_str {
+    static const bool value = false;
+};
+template <> struct is_str<char *> {
+    static const bool value = true;
+};
+template <> struct is_str<const char *> {
+    static const bool value = true;
+};
+template <> struct is_str<std::string> {
+    static const bool value = true;
+};
+#if __cplusplus >= 201703L
+template <> struct is_str<std::string_view> {
+    static const bool value = true;
+};
+#endif
+
+template <typename T> struct kind {
+    typedef typename std::decay<T>::type D;
+    static const int value = (is_str<D>::value ? CTEST_CMP_STR :
+                              (std::is_integral<D>::value || std::is_enum<D>::value) ? CTEST_CMP_INT :
+                              std::is_floating_point<D>::value ? CTEST_CMP_FLOAT :
+                              (std::is_pointer<D>::value || std::is_same<D, std::nullptr_t>::value) ? CTEST_CMP_PTR :
+                              CTEST_CMP_OTHER);
+};
+
+// enum按底层整数类型比较
+template <typename T, bool E = std::is_enum<T>::value> struct int_of {
+    typedef T type;
+};
+template <typename T> struct int_of<T, true> {
+    typedef typename std::underlying_type<T>::type type;
+};
+
+static inline const char *str_ptr(const char *s)
+{
+    return s;
+}
+static inline const char *str_ptr(const std::string &s)
+{
+    return s.c_str();
+}
+static inline str_view to_view(const char *s)
+{
+    return str_view(s, strlen(s));
+}
+static inline str_view to_view(const std::string &s)
+{
+    return str_view(s.data(), s.size());
+}
+#if __cplusplus >= 201703L
+static inline const char *str_ptr(std::string_view s)
+{
+    return s.data();
 }
+static inline str_view to_view(std::string_view s)
+{
+    return s;
+}
+#endif
 
-static inline void EXPECT_CTEST_EQ(
-    const char *location, const std::string &a, const std::string &b, bool neq)
+template <typename T> static inline uintptr_t ptr_value(T *p)
 {
-    if (!(a == b) ^ neq) {
-        printf("ERROR at %s\na=%s\nb=%s\n",
-               location, a.c_str(), b.c_str());
-        ctest_test_retval = 1;
-    }
+    return (uintptr_t)(const void *)p;
+}
+static inline uintptr_t ptr_value(std::nullptr_t)
+{
+    return 0;
 }
+template <typename T> static inline uintptr_t ptr_value(const T &v)
+{
+    return (uintptr_t)v;
+}
+
+// 有符号和无符号比较, 负数不等于任何无符号数
+template <bool SA, bool SB> struct int_cmp {
+    template <typename A, typename B> static bool eq(A a, B b)
+    {
+        return a == b;
+    }
+};
+template <> struct int_cmp<true, false> {
+    template <typename A, typename B> static bool eq(A a, B b)
+    {
+        return a >= 0 && (uint64_t)a == (uint64_t)b;
+    }
+};
+template <> struct int_cmp<false, true> {
+    template <typename A, typename B> static bool eq(A a, B b)
+    {
+        return b >= 0 && (uint64_t)a == (uint64_t)b;
+    }
+};
+
+template <int KA, int KB> struct cmp {
+    template <typename A, typename B> static bool eq(const A &a, const B &b)
+    {
+        return a == b;
+    }
+};
+template <> struct cmp<CTEST_CMP_STR, CTEST_CMP_STR> {
+    template <typename A, typename B> static bool eq(const A &a, const B &b)
+    {
+        if (str_ptr(a) == NULL || str_ptr(b) == NULL)
+            return str_ptr(a) == str_ptr(b);
+
+        return to_view(a) == to_view(b);
+    }
+};
+template <> struct cmp<CTEST_CMP_INT, CTEST_CMP_INT> {
+    template <typename A, typename B> static bool eq(const A &a, const B &b)
+    {
+        typedef typename int_of<A>::type IA;
+        typedef typename int_of<B>::type IB;
+        return int_cmp<std::is_signed<IA>::value, std::is_signed<IB>::value>::eq((IA)a, (IB)b);
+    }
+};
+struct ptr_cmp {
+    template <typename A, typename B> static bool eq(const A &a, const B &b)
+    {
+        return ptr_value(a) == ptr_value(b);
+    }
+};
+template <> struct cmp<CTEST_CMP_PTR, CTEST_CMP_PTR> : ptr_cmp {};
+template <> struct cmp<CTEST_CMP_PTR, CTEST_CMP_INT> : ptr_cmp {};
+template <> struct cmp<CTEST_CMP_INT, CTEST_CMP_PTR> : ptr_cmp {};
+template <> struct cmp<CTEST_CMP_STR, CTEST_CMP_PTR> {
+    template <typename A, typename B> static bool eq(const A &a, const B &b)
+    {
+        return ptr_value(str_ptr(a)) == ptr_value(b);
+    }
+};
+template <> struct cmp<CTEST_CMP_PTR, CTEST_CMP_STR> {
+    template <typename A, typename B> static bool eq(const A &a, const B &b)
+    {
+        return ptr_value(a) == ptr_value(str_ptr(b));
+    }
+};
+template <> struct cmp<CTEST_CMP_STR, CTEST_CMP_INT> : cmp<CTEST_CMP_STR, CTEST_CMP_PTR> {};
+template <> struct cmp<CTEST_CMP_INT, CTEST_CMP_STR> : cmp<CTEST_CMP_PTR, CTEST_CMP_STR> {};
 
-static inline void EXPECT_CTEST_EQ(
-    const char *location, const std::string &a, const char *const bcs, bool neq)
+template <typename A, typename B> static inline bool equal(const A &a, const B &b)
 {
-    EXPECT_CTEST_EQ(location, a, std::string(bcs), neq);
+    return cmp<kind<A>::value, kind<B>::value>::eq(a, b);
 }
 
-static inline void EXPECT_CTEST_EQ(
-    const char *location, const char *const acs, const std::string &b, bool neq)
+// 失败时才用到的格式化
+template <int K> struct printer {
+    template <typename T> static std::string print(const T &v)
+    {
+        char                    buffer[32];
+        snprintf(buffer, sizeof(buffer), "<%d-byte object>", (int)sizeof(v));
+        return buffer;
+    }
+};
+template <> struct printer<CTEST_CMP_STR> {
+    template <typename T> static std::string print(const T &v)
+    {
+        if (str_ptr(v) == NULL)
+            return "(null)";
+
+        str_view sv = to_view(v);
+        return std::string(sv.data(), sv.size());
+    }
+};
+template <> struct printer<CTEST_CMP_INT> {
+    template <typename T> static std::string print(const T &v)
+    {
+        typedef typename int_of<T>::type I;
+        char                    buffer[32];
+
+        if (std::is_signed<I>::value)
+            snprintf(buffer, sizeof(buffer), "%" PRId64, (int64_t)(I)v);
+        else
+            snprintf(buffer, sizeof(buffer), "%" PRIu64, (uint64_t)(I)v);
+
+        return buffer;
+    }
+};
+template <> struct printer<CTEST_CMP_FLOAT> {
+    template <typename T> static std::string print(const T &v)
+    {
+        char                    buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.17Lg", (long double)v);
+        return buffer;
+    }
+};
+template <> struct printer<CTEST_CMP_PTR> {
+    template <typename T> static std::string print(const T &v)
+    {
+        char                    buffer[32];
+        snprintf(buffer, sizeof(buffer), "%p", (void *)ptr_value(v));
+        return buffer;
+    }
+};
+
+template <typename A, typename B>
+__attribute__((noinline, cold)) void report(ctest_test_site_t *site, const char *expr, const A &a, const B &b)
 {
-    EXPECT_CTEST_EQ(location, std::string(acs), b, neq);
+    std::string             sa = printer<kind<A>::value>::print(a);
+    std::string             sb = printer<kind<B>::value>::print(b);
+
+    if (kind<A>::value == CTEST_CMP_STR && kind<B>::value == CTEST_CMP_STR)
+        ctest_test_site_fail(site, expr, "\na=%s\nb=%s", sa.c_str(), sb.c_str());
+    else
+        ctest_test_site_fail(site, expr, " (a=%s,b=%s)", sa.c_str(), sb.c_str());
 }
 
-static inline void EXPECT_CTEST_EQ(
-    const char *location, const char *const acs, const char *const bcs, bool neq)
+}
+
+template <typename A, typename B>
+static inline bool EXPECT_CTEST_EQ(ctest_test_site_t *site, const char *expr, const A &a, const B &b, bool neq)
 {
-    EXPECT_CTEST_EQ(location, std::string(acs), std::string(bcs), neq);
+    if (likely(ctest_test_cmp::equal(a, b) != neq))
+        return true;
+
+    ctest_test_cmp::report(site, expr, a, b);
+    return false;
 }
 #endif
 
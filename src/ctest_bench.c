@@ -0,0 +1,278 @@
+#include "ctest_bench.h"
+#include <math.h>
+
+/**
+ * A/B交替跑短的轮次, 每轮算一个比值, 频率和温度的漂移在一轮里对两边一样
+ */
+
+int                         ctest_bench_rounds = CTEST_BENCH_ROUNDS;
+const char                  *ctest_bench_csv = NULL;
+
+// 复杂度模型
+static const char           *ctest_bench_model_name[] = {"O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)"};
+
+static int64_t ctest_bench_calibrate(ctest_bench_pt *fn);
+static double ctest_bench_time(ctest_bench_pt *fn, int64_t n);
+static double ctest_bench_range_time(ctest_bench_range_pt *fn, int64_t size);
+static double ctest_bench_model(int model, double n);
+static void ctest_bench_write_csv(const char *name, int64_t *size, double *t, int cnt);
+static double ctest_bench_median(double *v, int n);
+static double ctest_bench_t975(int df);
+static int ctest_bench_double_cmp(const void *a, const void *b);
+
+int64_t ctest_bench_now()
+{
+    struct timespec         ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * 比较两个实现, 输出B相对A的加速比和95%置信区间
+ */
+int ctest_bench_compare(const char *name, const char *aname, ctest_bench_pt *fa,
+                        const char *bname, ctest_bench_pt *fb)
+{
+    double                  *ta, *tb, *lr, mean, sd, half;
+    int64_t                 na, nb;
+    int                     i, rounds;
+
+    rounds = ctest_max(2, ctest_min(ctest_bench_rounds, CTEST_BENCH_MAX_ROUNDS));
+
+    if ((ta = (double *)ctest_malloc(3 * rounds * sizeof(double))) == NULL)
+        return CTEST_ERROR;
+
+    tb = ta + rounds;
+    lr = tb + rounds;
+    na = ctest_bench_calibrate(fa);
+    nb = ctest_bench_calibrate(fb);
+
+    // ABBA顺序, 先后顺序的影响也抵消掉
+    for(i = 0; i < rounds; i++) {
+        if (i & 1) {
+            tb[i] = ctest_bench_time(fb, nb);
+            ta[i] = ctest_bench_time(fa, na);
+        } else {
+            ta[i] = ctest_bench_time(fa, na);
+            tb[i] = ctest_bench_time(fb, nb);
+        }
+
+        lr[i] = log(ta[i] / tb[i]);
+    }
+
+    for(i = 0, mean = 0; i < rounds; i++)
+        mean += lr[i];
+
+    mean /= rounds;
+
+    for(i = 0, sd = 0; i < rounds; i++)
+        sd += (lr[i] - mean) * (lr[i] - mean);
+
+    sd = sqrt(sd / (rounds - 1));
+    half = ctest_bench_t975(rounds - 1) * sd / sqrt(rounds);
+
+    printf("BENCH %s: %s %.2f ns/op, %s %.2f ns/op (median of %d rounds)\n", name,
+           aname, ctest_bench_median(ta, rounds), bname, ctest_bench_median(tb, rounds), rounds);
+    printf("BENCH %s: %s/%s speedup %.3fx, 95%% CI [%.3f, %.3f]%s\n", name, bname, aname,
+           exp(mean), exp(mean - half), exp(mean + half),
+           (mean - half > 0 ? ", B faster" : (mean + half < 0 ? ", A faster" : ", no significant difference")));
+
+    ctest_free(ta);
+    return CTEST_OK;
+}
+
+/**
+ * 规模从lo按multiplier增长到hi, 对每种复杂度用最小二乘拟合t = c * f(n), 取相对RMS误差最小的
+ */
+int ctest_bench_range(const char *name, ctest_bench_range_pt *fn,
+                      int64_t lo, int64_t hi, double multiplier)
+{
+    int64_t                 size[CTEST_BENCH_RANGE_MAX], s;
+    double                  t[CTEST_BENCH_RANGE_MAX], c[5], rms[5], sfx, sff, sum, f, e;
+    int                     i, m, cnt, best;
+
+    if (lo < 1 || hi < lo || multiplier <= 1)
+        return CTEST_ERROR;
+
+    for(cnt = 0, s = lo; s <= hi && cnt < CTEST_BENCH_RANGE_MAX; cnt++) {
+        size[cnt] = s;
+        t[cnt] = ctest_bench_range_time(fn, s);
+        printf("BENCH %s/%" PRId64 ": %.2f ns/op\n", name, s, t[cnt]);
+        s = ctest_max(s + 1, (int64_t)(s * multiplier));
+    }
+
+    if (ctest_bench_csv)
+        ctest_bench_write_csv(name, size, t, cnt);
+
+    if (cnt < 3) return CTEST_OK;
+
+    for(i = 0, sum = 0; i < cnt; i++)
+        sum += t[i];
+
+    // 被优化掉了
+    if (sum <= 0) return CTEST_OK;
+
+    for(m = best = 0; m < 5; m++) {
+        for(i = 0, sfx = sff = 0; i < cnt; i++) {
+            f = ctest_bench_model(m, size[i]);
+            sfx += f * t[i];
+            sff += f * f;
+        }
+
+        c[m] = sfx / sff;
+
+        for(i = 0, e = 0; i < cnt; i++) {
+            f = t[i] - c[m] * ctest_bench_model(m, size[i]);
+            e += f * f;
+        }
+
+        // 相对平均时间
+        rms[m] = sqrt(e / cnt) / (sum / cnt);
+
+        if (rms[m] < rms[best]) best = m;
+    }
+
+    printf("BENCH %s: best fit %s, c=%.4g ns, rms %.1f%%", name,
+           ctest_bench_model_name[best], c[best], rms[best] * 100);
+
+    for(m = 0; m < 5; m++) {
+        if (m != best)
+            printf("%s %s %.1f%%", (m == (best == 0)) ? " (others:" : ",", ctest_bench_model_name[m], rms[m] * 100);
+    }
+
+    printf(")\n");
+    return CTEST_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// 找到一轮大约CTEST_BENCH_SLICE_NS的n
+static int64_t ctest_bench_calibrate(ctest_bench_pt *fn)
+{
+    int64_t                 n = 1;
+    double                  t;
+
+    for(;;) {
+        t = ctest_bench_time(fn, n) * n;
+
+        if (t >= CTEST_BENCH_SLICE_NS || n >= (INT64_MAX >> 4))
+            break;
+
+        n = (t < CTEST_BENCH_SLICE_NS / 100 ? n * 10 : (int64_t)(n * 1.2 * CTEST_BENCH_SLICE_NS / t) + 1);
+    }
+
+    return n;
+}
+
+// 每次的ns
+static double ctest_bench_time(ctest_bench_pt *fn, int64_t n)
+{
+    int64_t                 t1;
+
+    t1 = ctest_bench_now();
+    (*fn)(n);
+    return (double)(ctest_bench_now() - t1) / n;
+}
+
+// 校准n以后跑几次取中位数
+static double ctest_bench_range_time(ctest_bench_range_pt *fn, int64_t size)
+{
+    double                  t[CTEST_BENCH_RANGE_REPEAT], d;
+    int64_t                 n = 1, t1;
+    int                     i;
+
+    for(;;) {
+        t1 = ctest_bench_now();
+        (*fn)(n, size);
+        d = (double)(ctest_bench_now() - t1);
+
+        if (d >= CTEST_BENCH_SLICE_NS || n >= (INT64_MAX >> 4))
+            break;
+
+        n = (d < CTEST_BENCH_SLICE_NS / 100 ? n * 10 : (int64_t)(n * 1.2 * CTEST_BENCH_SLICE_NS / d) + 1);
+    }
+
+    for(i = 0; i < CTEST_BENCH_RANGE_REPEAT; i++) {
+        t1 = ctest_bench_now();
+        (*fn)(n, size);
+        t[i] = (double)(ctest_bench_now() - t1) / n;
+    }
+
+    return ctest_bench_median(t, CTEST_BENCH_RANGE_REPEAT);
+}
+
+static double ctest_bench_model(int model, double n)
+{
+    switch(model) {
+    case 0:
+        return 1;
+
+    case 1:
+        return log2(n) + 1;
+
+    case 2:
+        return n;
+
+    case 3:
+        return n * (log2(n) + 1);
+
+    default:
+        return n * n;
+    }
+}
+
+// 追加到csv, 空文件先写表头
+static void ctest_bench_write_csv(const char *name, int64_t *size, double *t, int cnt)
+{
+    FILE                    *fp;
+    int                     i;
+
+    if ((fp = fopen(ctest_bench_csv, "a")) == NULL) {
+        fprintf(stderr, "open %s: %s\n", ctest_bench_csv, strerror(errno));
+        return;
+    }
+
+    if (ftell(fp) == 0)
+        fprintf(fp, "name,size,ns_per_op\n");
+
+    for(i = 0; i < cnt; i++)
+        fprintf(fp, "%s,%" PRId64 ",%.3f\n", name, size[i], t[i]);
+
+    fclose(fp);
+}
+
+static double ctest_bench_median(double *v, int n)
+{
+    double                  *s, m;
+
+    if ((s = (double *)ctest_malloc(n * sizeof(double))) == NULL)
+        return v[0];
+
+    memcpy(s, v, n * sizeof(double));
+    qsort(s, n, sizeof(double), ctest_bench_double_cmp);
+    m = ((n & 1) ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2);
+    ctest_free(s);
+    return m;
+}
+
+// student t分布的97.5%分位数
+static double ctest_bench_t975(int df)
+{
+    static const double     t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+                                  };
+
+    if (df <= 0) return t[0];
+
+    if (df <= 30) return t[df - 1];
+
+    return (df <= 60 ? 2.000 : 1.960);
+}
+
+static int ctest_bench_double_cmp(const void *a, const void *b)
+{
+    double                  da = *(const double *)a;
+    double                  db = *(const double *)b;
+
+    return (da < db ? -1 : (da > db ? 1 : 0));
+}
@@ -0,0 +1,35 @@
+#ifndef CTEST_BENCH_H_
+#define CTEST_BENCH_H_
+
+/**
+ * benchmark, 每个variant是void fn(int64_t n), 执行n次被测代码
+ */
+#include "ctest_define.h"
+
+CTEST_CPP_START
+
+#define CTEST_BENCH_ROUNDS           30
+#define CTEST_BENCH_MAX_ROUNDS       1000
+#define CTEST_BENCH_SLICE_NS         2000000
+#define CTEST_BENCH_RANGE_REPEAT     5
+#define CTEST_BENCH_RANGE_MAX        64
+
+typedef void (ctest_bench_pt)(int64_t n);
+// 输入规模为size, 执行n次
+typedef void (ctest_bench_range_pt)(int64_t n, int64_t size);
+
+extern int ctest_bench_rounds;
+extern const char *ctest_bench_csv;
+
+extern int64_t ctest_bench_now();
+extern int ctest_bench_compare(const char *name, const char *aname, ctest_bench_pt *fa,
+                               const char *bname, ctest_bench_pt *fb);
+extern int ctest_bench_range(const char *name, ctest_bench_range_pt *fn,
+                             int64_t lo, int64_t hi, double multiplier);
+
+// 防止被测的值被优化掉
+#define BENCH_KEEP(x)  __asm__ __volatile__("" : : "g"(x) : "memory")
+
+CTEST_CPP_END
+
+#endif
@@ -105,21 +105,51 @@ void ctest_buf_destroy(ctest_buf_t *b)
  */
 int ctest_buf_check_read_space(ctest_pool_t *pool, ctest_buf_t *b, uint32_t size)
 {
-    int                     dsize;
-    char                    *ptr;
+    int                     dsize, large;
+    uint32_t                need;
+    char                    *ptr, *base;
 
     if ((b->end - b->last) >= (int)size)
         return CTEST_OK;
 
     // 需要大小
     dsize = (b->last - b->pos);
+    need = size;
     size = ctest_max(dsize * 3 / 2, size + dsize);
     size = ctest_align(size, CTEST_POOL_PAGE_SIZE);
 
+    // large的先挪到开头, 不够再原地扩, 旧的不会留在pool里
+    if ((b->flags & CTEST_BUF_LARGE) && (base = (char *)ctest_pool_large_base(pool, b->start)) != NULL) {
+        if (dsize > 0 && b->pos != base)
+            memmove(base, b->pos, dsize);
+
+        b->pos = base;
+        b->last = base + dsize;
+
+        if ((b->end - b->last) >= (int)need)
+            return CTEST_OK;
+
+        if ((ptr = (char *)ctest_pool_realloc_large(pool, base, size)) == NULL)
+            return CTEST_ERROR;
+
+        b->start = ptr;
+        b->pos = ptr;
+        b->last = b->pos + dsize;
+        b->end = b->pos + size;
+        return CTEST_OK;
+    }
+
     // alloc
+    large = (size > pool->max);
+
     if ((ptr = (char *)ctest_pool_alloc(pool, size)) == NULL)
         return CTEST_ERROR;
 
+    if (large) {
+        b->flags |= CTEST_BUF_LARGE;
+        b->start = ptr;
+    }
+
     // copy old buf to new buf
     if (dsize > 0)
         memcpy(ptr, b->pos, dsize);
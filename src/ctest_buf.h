@@ -11,6 +11,7 @@ CTEST_CPP_START
 
 #define CTEST_BUF_FILE        1
 #define CTEST_BUF_CLOSE_FILE  3
+#define CTEST_BUF_LARGE       4
 
 typedef struct ctest_buf_t ctest_buf_t;
 typedef struct ctest_file_buf_t ctest_file_buf_t;
@@ -28,6 +29,7 @@ struct ctest_buf_t {
     char                    *pos;
     char                    *last;
     char                    *end;
+    char                    *start;     // CTEST_BUF_LARGE时是large的开头
 };
 
 struct ctest_file_buf_t {
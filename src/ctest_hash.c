@@ -385,9 +385,10 @@ uint64_t ctest_hash_code(const void *key, int len, unsigned int seed)
 
     h1 = h2 = seed;
 
-    for(i = 0; i < nblocks; i += 2) {
-        k1 = blocks[i];
-        k2 = blocks[i + 1];
+    // 每个block两个uint64
+    for(i = 0; i < nblocks; i++) {
+        k1 = blocks[i * 2];
+        k2 = blocks[i * 2 + 1];
 
         k1                      *= c1;
         k1  = ROL64(k1, 31);
@@ -1,120 +1,524 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "ctest_pool.h"
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 /**
  * 简单的内存池
  */
 
-static void *ctest_pool_alloc_block(ctest_pool_t *pool, uint32_t size);
-static void *ctest_pool_alloc_large(ctest_pool_t *pool, ctest_pool_large_t *large, uint32_t size);
+static void *ctest_pool_alloc_block(ctest_pool_t *pool, uint32_t size, int align);
+static void *ctest_pool_alloc_large(ctest_pool_t *pool, uint32_t size, int zero, int align);
+static void ctest_pool_large_release(ctest_pool_large_t *l);
+static void *ctest_pool_alloc_shared(ctest_pool_t *pool, uint32_t size, int align, int zero);
+static void *ctest_pool_alloc_tls(ctest_pool_t *pool, uint32_t size, int align);
+static void ctest_pool_clear_ex(ctest_pool_t *pool, int reset);
+static void *ctest_pool_block_get(uint32_t size, int *zero, ctest_pool_realloc_pt *alloc);
+static void *ctest_pool_block_new(uint32_t size, int *zero, ctest_pool_realloc_pt *alloc);
+static void ctest_pool_block_put(void *block, uint32_t size, ctest_pool_realloc_pt alloc);
+static void *ctest_pool_mmap(uint32_t size, int flags);
+static void ctest_pool_block_free(ctest_pool_t *pool, ctest_pool_t *p);
+static ctest_pool_t *ctest_pool_create_in(ctest_pool_opt_t *opt, ctest_pool_t *parent);
+static void *ctest_pool_parent_alloc(ctest_pool_t *parent, uint32_t size, int *large);
+static ctest_pool_ext_t *ctest_pool_get_ext(ctest_pool_t *pool);
 ctest_pool_realloc_pt    ctest_pool_realloc = ctest_pool_default_realloc;
-#define CTEST_POOL_LOCK(pool) int kcolt = pool->flags; if (unlikely(kcolt)) ctest_spin_lock(&pool->tlock);
+
+/**
+ * 并发模式下每个线程从pool里预留一段chunk, chunk内分配不加锁也没有原子操作.
+ * slot用(pool, gen)识别, set_concurrent/clear/destroy换gen, 旧的chunk自然失效
+ */
+typedef struct ctest_pool_tls_t {
+    ctest_pool_t             *pool;
+    uint64_t                gen;
+    uint8_t                 *last;
+    uint8_t                 *end;
+} ctest_pool_tls_t;
+
+static ctest_atomic_t        ctest_pool_gen = 0;
+static __thread ctest_pool_tls_t ctest_pool_tls[CTEST_POOL_TLS_SLOTS];
+static __thread int         ctest_pool_tls_next = 0;
+/**
+ * 释放的block先放线程自己的magazine, 超过CTEST_POOL_MAGAZINE_SIZE倒进全局按大小分桶的cache.
+ * magazine和全局cache一起算在ctest_pool_cache_bytes里, 不超过ctest_pool_cache_limit, 为0时不缓存.
+ * block用分配它的allocator释放
+ */
+typedef struct ctest_pool_block_t ctest_pool_block_t;
+struct ctest_pool_block_t {
+    ctest_pool_block_t       *next;
+    ctest_pool_realloc_pt    alloc;
+    uint32_t                size;
+};
+
+typedef struct ctest_pool_bucket_t {
+    ctest_atomic_t           lock;
+    int                     cnt;
+    ctest_pool_block_t       *head;
+} ctest_pool_bucket_t;
+
+// 登记在全局表里, flush时可以倒空别的线程的magazine
+typedef struct ctest_pool_magazine_t {
+    ctest_atomic_t           lock;
+    int64_t                 bytes;
+    ctest_list_t             node;
+    ctest_pool_block_t       *head[CTEST_POOL_CACHE_BUCKETS];
+} ctest_pool_magazine_t;
+
+static void ctest_pool_magazine_flush(ctest_pool_magazine_t *mg);
+
+static int64_t              ctest_pool_cache_limit = 0;
+static ctest_atomic_t        ctest_pool_cache_bytes = 0;
+static ctest_pool_bucket_t   ctest_pool_cache[CTEST_POOL_CACHE_BUCKETS];
+static pthread_key_t        ctest_pool_cache_key;
+static pthread_once_t       ctest_pool_cache_once = PTHREAD_ONCE_INIT;
+static __thread ctest_pool_magazine_t ctest_pool_magazine;
+static __thread int         ctest_pool_magazine_used = 0;
+static ctest_atomic_t        ctest_pool_magazine_lock = 0;
+static ctest_list_t          ctest_pool_magazine_list = {&ctest_pool_magazine_list, &ctest_pool_magazine_list};
+
+/**
+ * pool里不常用的字段, 第一次用到时calloc, destroy时释放, 不占block的空间
+ */
+struct ctest_pool_ext_t {
+    ctest_pool_t             *pool;
+    ctest_list_t             reg_node;
+    ctest_pool_large_t       *large_cache;
+    int                     large_ncache;
+    ctest_pool_t             *parent;
+};
+
+// 所有pool的登记表, ctest_pool_set_registry打开以后创建的pool才登记
+static int                  ctest_pool_registry = 0;
+static ctest_atomic_t        ctest_pool_registry_lock = 0;
+static ctest_list_t          ctest_pool_registry_list = {&ctest_pool_registry_list, &ctest_pool_registry_list};
+
+#define CTEST_POOL_LOCK(pool) int kcolt = (pool->flags & CTEST_POOL_FLAG_LOCK); if (unlikely(kcolt)) ctest_spin_lock(&pool->tlock);
 #define CTEST_POOL_UNLOCK(pool) if (unlikely(kcolt)) ctest_spin_unlock(&pool->tlock);
 
 ctest_pool_t *ctest_pool_create(uint32_t size)
+{
+    ctest_pool_opt_t         opt;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.first_size = size;
+    return ctest_pool_create_ex(&opt);
+}
+
+ctest_pool_t *ctest_pool_create_ex(ctest_pool_opt_t *opt)
+{
+    return ctest_pool_create_in(opt, NULL);
+}
+
+/**
+ * 子pool, 头和block都从parent上分, 从parent的large分的destroy时单独还回去,
+ * 其他的等parent clear. 子pool活着时parent的ref不为0,
+ * 这期间parent不能release/reset/clear/destroy, 要先destroy子pool
+ */
+ctest_pool_t *ctest_pool_create_child(ctest_pool_t *parent, uint32_t size)
+{
+    ctest_pool_opt_t         opt;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.first_size = size;
+    return ctest_pool_create_in(&opt, parent);
+}
+
+static ctest_pool_t *ctest_pool_create_in(ctest_pool_opt_t *opt, ctest_pool_t *parent)
 {
     ctest_pool_t             *p;
+    ctest_pool_ext_t         *ext;
+    ctest_pool_realloc_pt    alloc;
+    uint32_t                size, bsize, align;
+    int                     flags, zero, large;
+
+    flags = (parent ? 0 : opt->flags & (CTEST_POOL_FLAG_MMAP | CTEST_POOL_FLAG_HUGETLB | CTEST_POOL_FLAG_THP));
+
+    if (flags & (CTEST_POOL_FLAG_HUGETLB | CTEST_POOL_FLAG_THP))
+        flags |= CTEST_POOL_FLAG_MMAP;
 
     // 对齐
-    size = ctest_align(size + sizeof(ctest_pool_t), CTEST_POOL_ALIGNMENT);
+    if (flags & (CTEST_POOL_FLAG_HUGETLB | CTEST_POOL_FLAG_THP))
+        align = CTEST_POOL_HUGE_PAGE_SIZE;
+    else if (flags & CTEST_POOL_FLAG_MMAP)
+        align = CTEST_POOL_PAGE_SIZE;
+    else
+        align = CTEST_POOL_ALIGNMENT;
+
+    size = ctest_align(opt->first_size + sizeof(ctest_pool_t), align);
+    bsize = (opt->block_size ? ctest_align(opt->block_size, align) : size);
+
+    zero = 1;
+    large = 0;
+    ext = NULL;
+    alloc = NULL;
+
+    // ext也在parent上
+    if (parent) {
+        zero = 0;
 
-    if ((p = (ctest_pool_t *)ctest_pool_realloc(NULL, size)) == NULL)
+        if ((ext = (ctest_pool_ext_t *)ctest_pool_calloc(parent, sizeof(ctest_pool_ext_t))) == NULL)
+            return NULL;
+
+        p = (ctest_pool_t *)ctest_pool_parent_alloc(parent, size, &large);
+    } else if (flags & CTEST_POOL_FLAG_MMAP) {
+        p = (ctest_pool_t *)ctest_pool_mmap(size, flags);
+    } else {
+        p = (ctest_pool_t *)ctest_pool_block_get(size, &zero, &alloc);
+    }
+
+    if (p == NULL)
         return NULL;
 
     memset(p, 0, sizeof(ctest_pool_t));
+    p->alloc = alloc;
     p->last = (uint8_t *) p + sizeof(ctest_pool_t);
     p->end = (uint8_t *) p + size;
-    p->max = size - sizeof(ctest_pool_t);
+    p->zero = (zero ? p->last : p->end);
+    p->max = bsize - sizeof(ctest_pool_t);
     p->current = p;
+    p->flags = flags;
+    p->block_size = p->next_size = bsize;
+    p->max_block = ctest_max(ctest_align(opt->max_block_size ? opt->max_block_size : CTEST_POOL_MAX_BLOCK_SIZE, align), bsize);
+    p->tail = p;
+
+    if (parent) {
+        p->flags |= (CTEST_POOL_FLAG_CHILD | (large ? CTEST_POOL_FLAG_FROM_LARGE : 0));
+        p->ext = ext;
+        ext->pool = p;
+        ext->parent = parent;
+        ctest_list_init(&ext->reg_node);
+        ctest_atomic_inc(&parent->ref);
+    } else if (ctest_pool_registry && ctest_pool_get_ext(p) == NULL) {
+        ctest_pool_block_free(p, p);
+        return NULL;
+    }
+
 #ifdef CTEST_DEBUG_MAGIC
     p->magic = CTEST_DEBUG_MAGIC_POOL;
 #endif
 
+    // 子pool算在parent里
+    if (ctest_pool_registry && parent == NULL) {
+        p->flags |= CTEST_POOL_FLAG_REGISTERED;
+        ctest_spin_lock(&ctest_pool_registry_lock);
+        ctest_list_add_tail(&p->ext->reg_node, &ctest_pool_registry_list);
+        ctest_spin_unlock(&ctest_pool_registry_lock);
+    }
+
+    if (opt->flags & CTEST_POOL_FLAG_CONCURRENT)
+        ctest_pool_set_concurrent(p);
+    else if (opt->flags & CTEST_POOL_FLAG_LOCK)
+        ctest_pool_set_lock(p);
+
     return p;
 }
 
 // clear
 void ctest_pool_clear(ctest_pool_t *pool)
+{
+    ctest_pool_clear_ex(pool, 0);
+}
+
+// 和clear一样, 但留着block下次用
+void ctest_pool_reset(ctest_pool_t *pool)
+{
+    ctest_pool_clear_ex(pool, 1);
+}
+
+static void ctest_pool_clear_ex(ctest_pool_t *pool, int reset)
 {
     ctest_pool_t             *p, *n;
-    ctest_pool_large_t       *l;
+    ctest_pool_large_t       *l, *ln;
     ctest_pool_cleanup_t     *cl;
+    ctest_pool_ext_t         *ext;
+
+    // 有子pool时不能回收
+    assert(pool->ref == 0);
 
     // cleanup
     for (cl = pool->cleanup; cl; cl = cl->next) {
         if (cl->handler) (*cl->handler)(cl->data);
     }
 
-    // large
-    for(l = pool->large; l; l = l->next) {
-        ctest_pool_realloc(l->data, 0);
+    // large, reset时留几个在cache里
+    ext = (reset && pool->large ? ctest_pool_get_ext(pool) : pool->ext);
+
+    for(l = pool->large; l; l = ln) {
+        ln = l->next;
+
+        if (reset && ext && ext->large_ncache < CTEST_POOL_LARGE_CACHE) {
+            l->magic = 0;
+            l->next = ext->large_cache;
+            ext->large_cache = l;
+            ext->large_ncache ++;
+        } else {
+            ctest_pool_large_release(l);
+        }
+    }
+
+    if (reset == 0 && ext) {
+        for(l = ext->large_cache; l; l = ln) {
+            ln = l->next;
+            ctest_pool_large_release(l);
+        }
+
+        ext->large_cache = NULL;
+        ext->large_ncache = 0;
     }
 
-    // other page
-    for(p = pool->next; p; p = n) {
-        n = p->next;
-        ctest_pool_realloc(p, 0);
+    // other page, reset时挂到spare上按原来的顺序再用
+    if (reset && pool->next) {
+        pool->tail->next = pool->spare;
+        pool->spare = pool->next;
+    } else if (reset == 0) {
+        for(p = pool->next; p; p = n) {
+            n = p->next;
+            ctest_pool_block_free(pool, p);
+        }
+
+        for(p = pool->spare; p; p = n) {
+            n = p->next;
+            ctest_pool_block_free(pool, p);
+        }
+
+        pool->spare = NULL;
+        pool->next_size = pool->block_size;
+        pool->max = pool->block_size - sizeof(ctest_pool_t);
     }
 
+    pool->next = NULL;
+    pool->tail = pool;
     pool->cleanup = NULL;
     pool->large = NULL;
-    pool->next = NULL;
     pool->current = pool;
     pool->failed = 0;
     pool->last = (uint8_t *) pool + sizeof(ctest_pool_t);
+    pool->peak = ctest_max(pool->peak, pool->requested);
+    pool->requested = 0;
+    pool->align_waste = 0;
+
+    if (pool->flags & CTEST_POOL_FLAG_CONCURRENT)
+        pool->gen = ctest_atomic_add_return(&ctest_pool_gen, 1);
 }
 
 void ctest_pool_destroy(ctest_pool_t *pool)
 {
+    ctest_pool_t             *parent;
+
     ctest_pool_clear(pool);
-    assert(pool->ref == 0);
+    parent = ((pool->flags & CTEST_POOL_FLAG_CHILD) ? pool->ext->parent : NULL);
+
+    if (pool->flags & CTEST_POOL_FLAG_REGISTERED) {
+        ctest_spin_lock(&ctest_pool_registry_lock);
+        ctest_list_del(&pool->ext->reg_node);
+        ctest_spin_unlock(&ctest_pool_registry_lock);
+    }
+
+    // 子pool的ext在parent上
+    if (pool->ext && (pool->flags & CTEST_POOL_FLAG_CHILD) == 0)
+        free(pool->ext);
+
 #ifdef CTEST_DEBUG_MAGIC
     pool->magic ++;
 #endif
-    ctest_pool_realloc(pool, 0);
+    ctest_pool_block_free(pool, pool);
+
+    if (parent)
+        ctest_atomic_dec(&parent->ref);
+}
+
+static ctest_pool_ext_t *ctest_pool_get_ext(ctest_pool_t *pool)
+{
+    if (pool->ext == NULL && (pool->ext = (ctest_pool_ext_t *)calloc(1, sizeof(ctest_pool_ext_t))) != NULL) {
+        pool->ext->pool = pool;
+        ctest_list_init(&pool->ext->reg_node);
+    }
+
+    return pool->ext;
+}
+
+/**
+ * 给子pool从parent上分一块, large记下是不是从parent的large分的.
+ * parent的max在两次clear之间只会变大, 不是large的到alloc_shared里也不会变成large
+ */
+static void *ctest_pool_parent_alloc(ctest_pool_t *parent, uint32_t size, int *large)
+{
+    void                    *m = NULL;
+
+    CTEST_POOL_LOCK(parent);
+
+    if ((*large = (size > parent->max)))
+        m = ctest_pool_alloc_large(parent, size, 0, 16);
+
+    CTEST_POOL_UNLOCK(parent);
+
+    if (*large == 0)
+        m = ctest_pool_alloc_shared(parent, size, 16, 0);
+
+    return m;
+}
+
+/**
+ * 记下当前位置, 之后的分配都在tail以后
+ */
+ctest_pool_mark_t ctest_pool_mark(ctest_pool_t *pool)
+{
+    ctest_pool_mark_t        mark;
+
+    CTEST_POOL_LOCK(pool);
+    mark.current = pool->current;
+    mark.tail = pool->tail;
+    mark.last = pool->tail->last;
+    mark.cleanup = pool->cleanup;
+    mark.large_seq = pool->large_seq;
+    mark.requested = pool->requested;
+    pool->current = pool->tail;
+
+    // 线程手里mark以前的chunk不能再用, release回收不了
+    if (pool->flags & CTEST_POOL_FLAG_CONCURRENT)
+        pool->gen = ctest_atomic_add_return(&ctest_pool_gen, 1);
+
+    CTEST_POOL_UNLOCK(pool);
+
+    return mark;
+}
+
+/**
+ * 回到mark: 跑mark以后注册的cleanup, 释放mark以后的large,
+ * mark以后新加的block放到spare上, 只和mark以后的分配有关
+ */
+void ctest_pool_release(ctest_pool_t *pool, ctest_pool_mark_t *mark)
+{
+    ctest_pool_cleanup_t     *cl;
+    ctest_pool_large_t       *l;
+    ctest_pool_t             *p;
+
+    // 有子pool时不能回到mark, cleanup不拿着锁
+    assert(pool->ref == 0);
+
+    for (cl = pool->cleanup; cl != mark->cleanup; cl = cl->next) {
+        if (cl->handler) (*cl->handler)(cl->data);
+    }
+
+    CTEST_POOL_LOCK(pool);
+    pool->cleanup = mark->cleanup;
+
+    // large是按seq倒序的
+    while((l = pool->large) && (int32_t)(l->seq - mark->large_seq) >= 0) {
+        pool->large = l->next;
+
+        if (pool->large)
+            pool->large->prev = NULL;
+
+        ctest_pool_large_release(l);
+    }
+
+    if ((p = mark->tail->next) != NULL) {
+        pool->tail->next = pool->spare;
+        pool->spare = p;
+    }
+
+    mark->tail->next = NULL;
+    mark->tail->last = mark->last;
+    pool->tail = mark->tail;
+    pool->current = mark->current;
+    pool->peak = ctest_max(pool->peak, pool->requested);
+    pool->requested = mark->requested;
+
+    if (pool->flags & CTEST_POOL_FLAG_CONCURRENT)
+        pool->gen = ctest_atomic_add_return(&ctest_pool_gen, 1);
+
+    CTEST_POOL_UNLOCK(pool);
 }
 
 void *ctest_pool_alloc_ex(ctest_pool_t *pool, uint32_t size, int align)
+{
+    if (pool->flags & CTEST_POOL_FLAG_CONCURRENT)
+        return ctest_pool_alloc_tls(pool, size, align);
+
+    return ctest_pool_alloc_shared(pool, size, align, 0);
+}
+
+/**
+ * zero非0时返回清零的内存, 只memset zero水位以下用过的部分
+ */
+static void *ctest_pool_alloc_shared(ctest_pool_t *pool, uint32_t size, int align, int zero)
 {
     uint8_t                 *m;
     ctest_pool_t             *p;
-    int                     dsize;
+    int                     n, dirty;
 
-    // init
-    dsize = 0;
+    CTEST_POOL_LOCK(pool);
 
-    if (size > pool->max) {
-        dsize = size;
-        size = sizeof(ctest_pool_large_t);
+    // 对齐要求高的, 加上对齐放不下也走large
+    if (size > pool->max || (align > 16 && size + align > pool->max)) {
+        m = (uint8_t *)ctest_pool_alloc_large(pool, size, zero, align);
+        CTEST_POOL_UNLOCK(pool);
+        return m;
     }
 
-    CTEST_POOL_LOCK(pool);
+    pool->requested += size;
+    pool->peak = ctest_max(pool->peak, pool->requested);
 
     p = pool->current;
+    n = 0;
 
+    // 最多看CTEST_POOL_SCAN_BLOCKS个block
     do {
         m = ctest_align_ptr(p->last, align);
 
         if (m + size <= p->end) {
+            pool->align_waste += m - p->last;
             p->last = m + size;
             break;
         }
 
         p = p->next;
-    } while (p);
+    } while (p && ++n < CTEST_POOL_SCAN_BLOCKS);
+
+    // 窗口外面的tail是最新最大的block, 分新block之前先看看它
+    if (n == CTEST_POOL_SCAN_BLOCKS) {
+        p = pool->tail;
+        m = ctest_align_ptr(p->last, align);
+
+        if (m + size <= p->end) {
+            pool->align_waste += m - p->last;
+            p->last = m + size;
+        } else {
+            p = NULL;
+        }
+    }
 
     // 重新分配一块出来
     if (p == NULL) {
-        m = (uint8_t *)ctest_pool_alloc_block(pool, size);
+        if ((m = (uint8_t *)ctest_pool_alloc_block(pool, size, align)) == NULL) {
+            CTEST_POOL_UNLOCK(pool);
+            return NULL;
+        }
+
+        p = pool->tail;
     }
 
-    if (m && dsize) {
-        m = (uint8_t *)ctest_pool_alloc_large(pool, (ctest_pool_large_t *)m, dsize);
+    // [zero, end)从来没分出去过
+    dirty = 0;
+
+    if (m + size > p->zero) {
+        if (zero && m < p->zero)
+            dirty = p->zero - m;
+
+        p->zero = m + size;
+    } else if (zero) {
+        dirty = size;
     }
 
     CTEST_POOL_UNLOCK(pool);
 
+    if (dirty)
+        memset(m, 0, dirty);
+
     return m;
 }
 
@@ -122,16 +526,36 @@ void *ctest_pool_calloc(ctest_pool_t *pool, uint32_t size)
 {
     void                    *p;
 
-    if ((p = ctest_pool_alloc_ex(pool, size, sizeof(long))) != NULL)
-        memset(p, 0, size);
+    // 并发模式下线程的chunk不记水位
+    if (pool->flags & CTEST_POOL_FLAG_CONCURRENT) {
+        if ((p = ctest_pool_alloc_ex(pool, size, sizeof(long))) != NULL)
+            memset(p, 0, size);
 
-    return p;
+        return p;
+    }
+
+    return ctest_pool_alloc_shared(pool, size, sizeof(long), 1);
+}
+
+void *ctest_pool_calloc_array(ctest_pool_t *pool, uint32_t n, uint32_t size)
+{
+    if (size && n > UINT32_MAX / size)
+        return NULL;
+
+    return ctest_pool_calloc(pool, n * size);
 }
 
 // set lock
 void ctest_pool_set_lock(ctest_pool_t *pool)
 {
-    pool->flags = 1;
+    pool->flags |= CTEST_POOL_FLAG_LOCK;
+}
+
+// 多线程共享, 小块从线程自己的chunk里分配
+void ctest_pool_set_concurrent(ctest_pool_t *pool)
+{
+    pool->flags |= (CTEST_POOL_FLAG_LOCK | CTEST_POOL_FLAG_CONCURRENT);
+    pool->gen = ctest_atomic_add_return(&ctest_pool_gen, 1);
 }
 
 // set realloc
@@ -140,6 +564,51 @@ void ctest_pool_set_allocator(ctest_pool_realloc_pt alloc)
     ctest_pool_realloc = (alloc ? alloc : ctest_pool_default_realloc);
 }
 
+/**
+ * 全局cache最多留多少字节的block, 0表示不缓存
+ */
+void ctest_pool_set_cache_limit(int64_t bytes)
+{
+    ctest_pool_cache_limit = bytes;
+
+    if (ctest_pool_cache_bytes > bytes)
+        ctest_pool_cache_flush();
+}
+
+// 所有线程的magazine先倒进全局cache, 再全部还掉
+void ctest_pool_cache_flush()
+{
+    ctest_pool_magazine_t    *mg;
+    ctest_pool_bucket_t      *b;
+    ctest_pool_block_t       *list, *n;
+    int                     i;
+
+    ctest_spin_lock(&ctest_pool_magazine_lock);
+
+    ctest_list_for_each_entry(mg, &ctest_pool_magazine_list, node) {
+        ctest_spin_lock(&mg->lock);
+        ctest_pool_magazine_flush(mg);
+        ctest_spin_unlock(&mg->lock);
+    }
+
+    ctest_spin_unlock(&ctest_pool_magazine_lock);
+
+    for(i = 0; i < CTEST_POOL_CACHE_BUCKETS; i++) {
+        b = &ctest_pool_cache[i];
+        ctest_spin_lock(&b->lock);
+        list = b->head;
+        b->head = NULL;
+        b->cnt = 0;
+        ctest_spin_unlock(&b->lock);
+
+        for(; list; list = n) {
+            n = list->next;
+            ctest_atomic_add(&ctest_pool_cache_bytes, -(int64_t)list->size);
+            list->alloc(list, 0);
+        }
+    }
+}
+
 void *ctest_pool_default_realloc (void *ptr, size_t size)
 {
     if (size) {
@@ -153,16 +622,49 @@ void *ctest_pool_default_realloc (void *ptr, size_t size)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // default realloc
 
-static void *ctest_pool_alloc_block(ctest_pool_t *pool, uint32_t size)
+static void *ctest_pool_alloc_block(ctest_pool_t *pool, uint32_t size, int align)
 {
     uint8_t                 *m;
     uint32_t                psize;
     ctest_pool_t             *p, *newpool, *current;
+    ctest_pool_realloc_pt    alloc;
+    int                     n, zero, large;
 
-    psize = (uint32_t) (pool->end - (uint8_t *) pool);
+    align = ctest_max(align, (int)sizeof(unsigned long));
 
-    if ((m = (uint8_t *)ctest_pool_realloc(NULL, psize)) == NULL)
-        return NULL;
+    // 先用reset留下来的
+    if ((m = (uint8_t *)pool->spare) != NULL && pool->spare->end - m >= size + align + sizeof(ctest_pool_t)) {
+        psize = pool->spare->end - m;
+        pool->spare = pool->spare->next;
+    } else {
+        psize = pool->next_size;
+        zero = 1;
+        large = 0;
+        alloc = NULL;
+
+        if (pool->flags & CTEST_POOL_FLAG_CHILD) {
+            zero = 0;
+            m = (uint8_t *)ctest_pool_parent_alloc(pool->ext->parent, psize, &large);
+        } else if (pool->flags & CTEST_POOL_FLAG_MMAP) {
+            m = (uint8_t *)ctest_pool_mmap(psize, pool->flags);
+        } else {
+            m = (uint8_t *)ctest_pool_block_get(psize, &zero, &alloc);
+        }
+
+        if (m == NULL)
+            return NULL;
+
+        ((ctest_pool_t *)m)->alloc = alloc;
+        ((ctest_pool_t *)m)->flags = (large ? CTEST_POOL_FLAG_FROM_LARGE : 0);
+
+        ((ctest_pool_t *)m)->zero = (zero ? ctest_align_ptr(m + offsetof(ctest_pool_t, current),
+                                     sizeof(unsigned long)) : m + psize);
+
+        // block翻倍, large的阈值跟着block大小走
+        pool->next_size = ctest_min(psize * 2, pool->max_block);
+        pool->next_size = ctest_max(pool->next_size, psize);
+        pool->max = psize - sizeof(ctest_pool_t);
+    }
 
     newpool = (ctest_pool_t *) m;
     newpool->end = m + psize;
@@ -170,30 +672,626 @@ static void *ctest_pool_alloc_block(ctest_pool_t *pool, uint32_t size)
     newpool->failed = 0;
 
     m += offsetof(ctest_pool_t, current);
-    m = ctest_align_ptr(m, sizeof(unsigned long));
+    m = ctest_align_ptr(m, align);
     newpool->last = m + size;
     current = pool->current;
 
-    for (p = current; p->next; p = p->next) {
+    for (p = current, n = 0; p && n < CTEST_POOL_SCAN_BLOCKS; p = p->next, n++) {
         if (p->failed++ > 4) {
             current = p->next;
         }
     }
 
-    p->next = newpool;
+    pool->tail->next = newpool;
+    pool->tail = newpool;
     pool->current = current ? current : newpool;
 
     return m;
 }
 
-static void *ctest_pool_alloc_large(ctest_pool_t *pool, ctest_pool_large_t *large, uint32_t size)
+/**
+ * 大的block用calloc, 从系统新拿的内存calloc不用再清零
+ */
+static void *ctest_pool_block_new(uint32_t size, int *zero, ctest_pool_realloc_pt *alloc)
+{
+    *alloc = ctest_pool_realloc;
+
+    if (size >= CTEST_POOL_ZERO_MIN && ctest_pool_realloc == ctest_pool_default_realloc) {
+        *zero = 1;
+        return calloc(1, size);
+    }
+
+    return ctest_pool_realloc(NULL, size);
+}
+
+static int ctest_pool_bucket_index(uint32_t size)
 {
-    if ((large->data = (uint8_t *)ctest_pool_realloc(NULL, size)) == NULL)
+    return 31 - __builtin_clz(size);
+}
+
+/**
+ * 先找magazine, 再找全局cache, 只复用同样大小同一个allocator分配的block
+ */
+static void *ctest_pool_block_get(uint32_t size, int *zero, ctest_pool_realloc_pt *alloc)
+{
+    ctest_pool_magazine_t    *mg;
+    ctest_pool_bucket_t      *b;
+    ctest_pool_block_t       **pp, *m;
+    int                     i;
+
+    *zero = 0;
+
+    if (ctest_pool_cache_limit == 0 || (i = ctest_pool_bucket_index(size)) >= CTEST_POOL_CACHE_BUCKETS)
+        return ctest_pool_block_new(size, zero, alloc);
+
+    m = NULL;
+
+    if (ctest_pool_magazine_used) {
+        mg = &ctest_pool_magazine;
+        ctest_spin_lock(&mg->lock);
+
+        for(pp = &mg->head[i]; (m = *pp); pp = &m->next) {
+            if (m->size == size && m->alloc == ctest_pool_realloc) {
+                *pp = m->next;
+                mg->bytes -= size;
+                break;
+            }
+        }
+
+        ctest_spin_unlock(&mg->lock);
+    }
+
+    b = &ctest_pool_cache[i];
+
+    if (m == NULL && b->head) {
+        ctest_spin_lock(&b->lock);
+
+        for(pp = &b->head; (m = *pp); pp = &m->next) {
+            if (m->size == size && m->alloc == ctest_pool_realloc) {
+                *pp = m->next;
+                b->cnt --;
+                break;
+            }
+        }
+
+        ctest_spin_unlock(&b->lock);
+    }
+
+    if (m == NULL)
+        return ctest_pool_block_new(size, zero, alloc);
+
+    ctest_atomic_add(&ctest_pool_cache_bytes, -(int64_t)size);
+    *alloc = m->alloc;
+    return m;
+}
+
+// 放进全局cache, 字节数已经算过了
+static void ctest_pool_bucket_push(ctest_pool_block_t *m)
+{
+    ctest_pool_bucket_t      *b;
+
+    b = &ctest_pool_cache[ctest_pool_bucket_index(m->size)];
+    ctest_spin_lock(&b->lock);
+    m->next = b->head;
+    b->head = m;
+    b->cnt ++;
+    ctest_spin_unlock(&b->lock);
+}
+
+// magazine整个倒进全局cache, 拿着mg->lock调用
+static void ctest_pool_magazine_flush(ctest_pool_magazine_t *mg)
+{
+    ctest_pool_block_t       *m, *n;
+    int                     i;
+
+    for(i = 0; i < CTEST_POOL_CACHE_BUCKETS; i++) {
+        for(m = mg->head[i]; m; m = n) {
+            n = m->next;
+            ctest_pool_bucket_push(m);
+        }
+
+        mg->head[i] = NULL;
+    }
+
+    mg->bytes = 0;
+}
+
+// 线程退出时把magazine还给全局
+static void ctest_pool_magazine_release(void *data)
+{
+    ctest_pool_magazine_t    *mg = (ctest_pool_magazine_t *)data;
+
+    ctest_spin_lock(&ctest_pool_magazine_lock);
+    ctest_list_del(&mg->node);
+    ctest_spin_lock(&mg->lock);
+    ctest_pool_magazine_flush(mg);
+    ctest_spin_unlock(&mg->lock);
+    ctest_spin_unlock(&ctest_pool_magazine_lock);
+}
+
+static void ctest_pool_cache_init()
+{
+    pthread_key_create(&ctest_pool_cache_key, ctest_pool_magazine_release);
+}
+
+static void ctest_pool_block_put(void *block, uint32_t size, ctest_pool_realloc_pt alloc)
+{
+    ctest_pool_magazine_t    *mg;
+    ctest_pool_block_t       *m;
+    int                     i;
+
+    if (ctest_pool_cache_limit == 0 || (i = ctest_pool_bucket_index(size)) >= CTEST_POOL_CACHE_BUCKETS) {
+        alloc(block, 0);
+        return;
+    }
+
+    // 超过limit的直接释放
+    if (ctest_atomic_add_return(&ctest_pool_cache_bytes, size) > ctest_pool_cache_limit) {
+        ctest_atomic_add(&ctest_pool_cache_bytes, -(int64_t)size);
+        alloc(block, 0);
+        return;
+    }
+
+    m = (ctest_pool_block_t *)block;
+    m->alloc = alloc;
+    m->size = size;
+
+    if (size > CTEST_POOL_MAGAZINE_SIZE) {
+        ctest_pool_bucket_push(m);
+        return;
+    }
+
+    mg = &ctest_pool_magazine;
+
+    if (unlikely(ctest_pool_magazine_used == 0)) {
+        pthread_once(&ctest_pool_cache_once, ctest_pool_cache_init);
+        pthread_setspecific(ctest_pool_cache_key, mg);
+        ctest_spin_lock(&ctest_pool_magazine_lock);
+        ctest_list_add_tail(&mg->node, &ctest_pool_magazine_list);
+        ctest_spin_unlock(&ctest_pool_magazine_lock);
+        ctest_pool_magazine_used = 1;
+    }
+
+    ctest_spin_lock(&mg->lock);
+    m->next = mg->head[i];
+    mg->head[i] = m;
+
+    if ((mg->bytes += size) > CTEST_POOL_MAGAZINE_SIZE)
+        ctest_pool_magazine_flush(mg);
+
+    ctest_spin_unlock(&mg->lock);
+}
+
+/**
+ * mmap一个block, 要大页时先试MAP_HUGETLB, 不行就多映射2M对齐后madvise
+ */
+static void *ctest_pool_mmap(uint32_t size, int flags)
+{
+    uint8_t                 *m, *a;
+    size_t                  len;
+
+#ifdef MAP_HUGETLB
+    if (flags & CTEST_POOL_FLAG_HUGETLB) {
+        m = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (m != MAP_FAILED)
+            return m;
+    }
+#endif
+
+    if ((flags & (CTEST_POOL_FLAG_HUGETLB | CTEST_POOL_FLAG_THP)) == 0) {
+        m = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (m == MAP_FAILED ? NULL : m);
+    }
+
+    len = (size_t)size + CTEST_POOL_HUGE_PAGE_SIZE;
+    m = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (m == MAP_FAILED)
+        return NULL;
+
+    // 去掉头尾, 留下2M对齐的一段
+    a = ctest_align_ptr(m, CTEST_POOL_HUGE_PAGE_SIZE);
+
+    if (a > m)
+        munmap(m, a - m);
+
+    if (a + size < m + len)
+        munmap(a + size, (m + len) - (a + size));
+
+#ifdef MADV_HUGEPAGE
+    madvise(a, size, MADV_HUGEPAGE);
+#endif
+    return a;
+}
+
+static void ctest_pool_block_free(ctest_pool_t *pool, ctest_pool_t *p)
+{
+    // 子pool从parent的large分的还回去, 其他的跟着parent释放
+    if (pool->flags & CTEST_POOL_FLAG_CHILD) {
+        if (p->flags & CTEST_POOL_FLAG_FROM_LARGE)
+            ctest_pool_free_large(pool->ext->parent, p);
+    } else if (pool->flags & CTEST_POOL_FLAG_MMAP)
+        munmap(p, p->end - (uint8_t *)p);
+    else
+        ctest_pool_block_put(p, p->end - (uint8_t *)p, p->alloc);
+}
+
+static void *ctest_pool_alloc_tls(ctest_pool_t *pool, uint32_t size, int align)
+{
+    ctest_pool_tls_t         *t, *e;
+    uint8_t                 *m;
+    uint32_t                csize;
+
+    csize = ctest_min(CTEST_POOL_CHUNK_SIZE, pool->max / 4);
+
+    // 大的和对齐要求高的直接走共享的
+    if (size > csize / 2 || align > (int)sizeof(long))
+        return ctest_pool_alloc_shared(pool, size, align, 0);
+
+    e = ctest_pool_tls + CTEST_POOL_TLS_SLOTS;
+
+    for(t = ctest_pool_tls; t < e; t++) {
+        if (t->pool == pool && t->gen == pool->gen)
+            break;
+    }
+
+    if (t < e) {
+        m = ctest_align_ptr(t->last, align);
+
+        if (m + size <= t->end) {
+            t->last = m + size;
+            return m;
+        }
+    } else {
+        t = ctest_pool_tls + (ctest_pool_tls_next++ % CTEST_POOL_TLS_SLOTS);
+    }
+
+    // 换一个chunk
+    if ((m = (uint8_t *)ctest_pool_alloc_shared(pool, csize, sizeof(long), 0)) == NULL)
+        return NULL;
+
+    t->pool = pool;
+    t->gen = pool->gen;
+    t->end = m + csize;
+    t->last = m;
+    m = ctest_align_ptr(m, align);
+
+    if (m + size > t->end)
+        return ctest_pool_alloc_shared(pool, size, align, 0);
+
+    t->last = m + size;
+    return m;
+}
+
+/**
+ * 先在cache里找一个不小于size又不超过两倍的, 没有再分配, 加锁以后调用
+ */
+static void *ctest_pool_alloc_large(ctest_pool_t *pool, uint32_t size, int zero, int align)
+{
+    ctest_pool_large_t       *l, **pp;
+    ctest_pool_realloc_pt    alloc;
+    uint8_t                 *raw;
+    uint32_t                total;
+    int                     dirty = 1;
+
+    // 对齐超过16的多分配align, 头放在对齐以后的数据前面
+    align = ctest_max(align, 16);
+    total = size + sizeof(ctest_pool_large_t) + (align > 16 ? align : 0);
+
+    l = NULL;
+
+    if (pool->ext) {
+        for(pp = &pool->ext->large_cache; (l = *pp); pp = &l->next) {
+            if (l->size >= total && l->size / 2 <= total && ((uintptr_t)(l + 1) & (align - 1)) == 0) {
+                *pp = l->next;
+                pool->ext->large_ncache --;
+                break;
+            }
+        }
+    }
+
+    if (l == NULL) {
+        alloc = ctest_pool_realloc;
+
+        if (pool->flags & CTEST_POOL_FLAG_MMAP) {
+            total = ctest_align(total, CTEST_POOL_PAGE_SIZE);
+            raw = (uint8_t *)ctest_pool_mmap(total, CTEST_POOL_FLAG_MMAP);
+            alloc = NULL;
+            dirty = 0;
+        } else if (zero && alloc == ctest_pool_default_realloc) {
+            raw = (uint8_t *)calloc(1, total);
+            dirty = 0;
+        } else {
+            raw = (uint8_t *)alloc(NULL, total);
+        }
+
+        if (raw == NULL)
+            return NULL;
+
+        l = ((ctest_pool_large_t *)ctest_align_ptr(raw + sizeof(ctest_pool_large_t), align)) - 1;
+        l->alloc = alloc;
+        l->size = total;
+        l->offset = (uint8_t *)l - raw;
+        l->align = align;
+        l->flags = (pool->flags & CTEST_POOL_FLAG_MMAP);
+    }
+
+    l->magic = CTEST_POOL_MAGIC_LARGE;
+
+    l->prev = NULL;
+    l->next = pool->large;
+    l->seq = pool->large_seq++;
+
+    if (pool->large)
+        pool->large->prev = l;
+
+    pool->large = l;
+    pool->requested += l->size - sizeof(ctest_pool_large_t);
+
+    if (zero && dirty)
+        memset(l + 1, 0, size);
+
+    pool->peak = ctest_max(pool->peak, pool->requested);
+    return l + 1;
+}
+
+static void ctest_pool_large_release(ctest_pool_large_t *l)
+{
+    uint8_t                 *raw;
+
+    l->magic = 0;
+    raw = (uint8_t *)l - l->offset;
+
+    if (l->flags & CTEST_POOL_FLAG_MMAP)
+        munmap(raw, l->size);
+    else
+        l->alloc(raw, 0);
+}
+
+static void ctest_pool_large_unlink(ctest_pool_t *pool, ctest_pool_large_t *l)
+{
+    if (l->prev)
+        l->prev->next = l->next;
+    else
+        pool->large = l->next;
+
+    if (l->next)
+        l->next->prev = l->prev;
+}
+
+/**
+ * 释放一个large分配, 放进pool的cache里, 满了才真正释放
+ */
+void ctest_pool_free_large(ctest_pool_t *pool, void *ptr)
+{
+    ctest_pool_large_t       *l;
+    ctest_pool_ext_t         *ext;
+
+    if (ptr == NULL)
+        return;
+
+    l = ((ctest_pool_large_t *)ptr) - 1;
+    assert(l->magic == CTEST_POOL_MAGIC_LARGE);
+
+    CTEST_POOL_LOCK(pool);
+    ctest_pool_large_unlink(pool, l);
+    pool->requested -= l->size - sizeof(ctest_pool_large_t);
+    l->magic = 0;
+
+    if ((ext = ctest_pool_get_ext(pool)) && ext->large_ncache < CTEST_POOL_LARGE_CACHE) {
+        l->next = ext->large_cache;
+        ext->large_cache = l;
+        ext->large_ncache ++;
+        l = NULL;
+    }
+
+    CTEST_POOL_UNLOCK(pool);
+
+    if (l)
+        ctest_pool_large_release(l);
+}
+
+/**
+ * large扩容, mmap的用mremap, 其他的用allocator的realloc, 都可能原地扩.
+ * 对齐超过16的realloc以后对齐会变, 分一块新的拷过去
+ */
+void *ctest_pool_realloc_large(ctest_pool_t *pool, void *ptr, uint32_t size)
+{
+    ctest_pool_large_t       *l, *n;
+    uint32_t                total;
+
+    if (ptr == NULL) {
+        CTEST_POOL_LOCK(pool);
+        ptr = ctest_pool_alloc_large(pool, size, 0, 16);
+        CTEST_POOL_UNLOCK(pool);
+        return ptr;
+    }
+
+    l = ((ctest_pool_large_t *)ptr) - 1;
+    assert(l->magic == CTEST_POOL_MAGIC_LARGE);
+    total = size + sizeof(ctest_pool_large_t);
+
+    if (total + l->offset <= l->size)
+        return ptr;
+
+    if (l->align > 16) {
+        CTEST_POOL_LOCK(pool);
+        n = (ctest_pool_large_t *)ctest_pool_alloc_large(pool, size, 0, l->align);
+        CTEST_POOL_UNLOCK(pool);
+
+        if (n == NULL)
+            return NULL;
+
+        memcpy(n, ptr, l->size - l->offset - sizeof(ctest_pool_large_t));
+        ctest_pool_free_large(pool, ptr);
+        return n;
+    }
+
+    CTEST_POOL_LOCK(pool);
+    pool->requested -= l->size;
+
+    // 搬走以后旧地址上不能再留着magic
+    l->magic = 0;
+
+    if (l->flags & CTEST_POOL_FLAG_MMAP) {
+        total = ctest_align(total, CTEST_POOL_PAGE_SIZE);
+#ifdef MREMAP_MAYMOVE
+        n = (ctest_pool_large_t *)mremap(l, l->size, total, MREMAP_MAYMOVE);
+
+        if (n == MAP_FAILED)
+            n = NULL;
+
+#else
+
+        if ((n = (ctest_pool_large_t *)ctest_pool_mmap(total, CTEST_POOL_FLAG_MMAP)) != NULL) {
+            memcpy(n, l, l->size);
+            munmap(l, l->size);
+        }
+
+#endif
+    } else {
+        n = (ctest_pool_large_t *)l->alloc(l, total);
+    }
+
+    if (n == NULL) {
+        l->magic = CTEST_POOL_MAGIC_LARGE;
+        pool->requested += l->size;
+    }
+
+    // 地址变了, 前后的指针要改
+    if (n) {
+        n->magic = CTEST_POOL_MAGIC_LARGE;
+        n->size = total;
+        pool->requested += total;
+        pool->peak = ctest_max(pool->peak, pool->requested);
+
+        if (n->prev)
+            n->prev->next = n;
+        else
+            pool->large = n;
+
+        if (n->next)
+            n->next->prev = n;
+    }
+
+    CTEST_POOL_UNLOCK(pool);
+
+    return (n ? n + 1 : NULL);
+}
+
+/**
+ * ptr是一个还在用的large分配的开头时返回ptr, 否则返回NULL.
+ * 直接看ptr前面头上的magic, 不加锁也不遍历, ptr要是从pool里分配出来的
+ */
+void *ctest_pool_large_base(ctest_pool_t *pool, const void *ptr)
+{
+    ctest_pool_large_t       *l;
+
+    if (ptr == NULL || ((uintptr_t)ptr & 15))
         return NULL;
 
-    large->next = pool->large;
-    pool->large = large;
-    return large->data;
+    l = ((ctest_pool_large_t *)ptr) - 1;
+    return (l->magic == CTEST_POOL_MAGIC_LARGE ? (void *)ptr : NULL);
+}
+
+/**
+ * 一个pool的统计, 计数器直接读, 其他的遍历block和large算出来
+ */
+void ctest_pool_stats(ctest_pool_t *pool, ctest_pool_stat_t *st)
+{
+    ctest_pool_t             *p;
+    ctest_pool_large_t       *l;
+    ctest_pool_cleanup_t     *cl;
+    int                     before;
+
+    memset(st, 0, sizeof(ctest_pool_stat_t));
+    CTEST_POOL_LOCK(pool);
+
+    st->pools = 1;
+    st->requested = pool->requested;
+    st->peak = ctest_max(pool->peak, pool->requested);
+    st->align_waste = pool->align_waste;
+
+    for(p = pool, before = 1; p; p = p->next) {
+        if (p == pool->current)
+            before = 0;
+
+        st->blocks ++;
+        st->reserved += p->end - (uint8_t *)p;
+
+        if (before)
+            st->abandoned += p->end - p->last;
+        else
+            st->free += p->end - p->last;
+    }
+
+    for(p = pool->spare; p; p = p->next) {
+        st->reserved += p->end - (uint8_t *)p;
+        st->free += p->end - (uint8_t *)p;
+    }
+
+    for(l = pool->large; l; l = l->next) {
+        st->large_count ++;
+        st->large_bytes += l->size;
+    }
+
+    for(l = (pool->ext ? pool->ext->large_cache : NULL); l; l = l->next)
+        st->reserved += l->size;
+
+    st->reserved += st->large_bytes;
+
+    for(cl = pool->cleanup; cl; cl = cl->next)
+        st->cleanups ++;
+
+    CTEST_POOL_UNLOCK(pool);
+}
+
+// 之后创建的pool登记到全局表里
+void ctest_pool_set_registry(int enable)
+{
+    ctest_pool_registry = enable;
+}
+
+/**
+ * 登记过的pool加起来, peak也是相加.
+ * 没有CTEST_POOL_FLAG_LOCK的pool不加锁直接读, 别的线程正在用时结果不准, 只用来调试
+ */
+void ctest_pool_stats_all(ctest_pool_stat_t *st)
+{
+    ctest_pool_ext_t         *ext;
+    ctest_pool_stat_t        one;
+
+    memset(st, 0, sizeof(ctest_pool_stat_t));
+    ctest_spin_lock(&ctest_pool_registry_lock);
+
+    ctest_list_for_each_entry(ext, &ctest_pool_registry_list, reg_node) {
+        ctest_pool_stats(ext->pool, &one);
+
+        st->requested += one.requested;
+        st->reserved += one.reserved;
+        st->peak += one.peak;
+        st->align_waste += one.align_waste;
+        st->abandoned += one.abandoned;
+        st->free += one.free;
+        st->large_bytes += one.large_bytes;
+        st->blocks += one.blocks;
+        st->large_count += one.large_count;
+        st->cleanups += one.cleanups;
+        st->pools ++;
+    }
+
+    ctest_spin_unlock(&ctest_pool_registry_lock);
+}
+
+void ctest_pool_print_stats(ctest_pool_stat_t *st, FILE *fp)
+{
+    fprintf(fp, "pools: %d, blocks: %d, large: %d (%" PRId64 " bytes), cleanups: %d\n",
+            st->pools, st->blocks, st->large_count, st->large_bytes, st->cleanups);
+    fprintf(fp, "requested: %" PRId64 ", peak: %" PRId64 ", reserved: %" PRId64 "\n",
+            st->requested, st->peak, st->reserved);
+    fprintf(fp, "align waste: %" PRId64 ", abandoned: %" PRId64 ", free: %" PRId64 "\n",
+            st->align_waste, st->abandoned, st->free);
 }
 
 /**
@@ -219,7 +1317,7 @@ char *ctest_pool_strdup(ctest_pool_t *pool, const char *str)
 ctest_pool_cleanup_t *ctest_pool_cleanup_new(ctest_pool_t *pool, const void *data, ctest_pool_cleanup_pt *handler)
 {
     ctest_pool_cleanup_t *cl;
-    cl = ctest_pool_alloc(pool, sizeof(ctest_pool_t));
+    cl = ctest_pool_alloc(pool, sizeof(ctest_pool_cleanup_t));
 
     if (cl) {
         cl->handler = handler;
@@ -231,6 +1329,17 @@ ctest_pool_cleanup_t *ctest_pool_cleanup_new(ctest_pool_t *pool, const void *dat
 
 void ctest_pool_cleanup_reg(ctest_pool_t *pool, ctest_pool_cleanup_t *cl)
 {
+    ctest_pool_cleanup_t     *old;
+
+    if (pool->flags & CTEST_POOL_FLAG_CONCURRENT) {
+        do {
+            old = pool->cleanup;
+            cl->next = old;
+        } while(!ctest_atomic_cmp_set((ctest_atomic_t *)&pool->cleanup, (long)old, (long)cl));
+
+        return;
+    }
+
     CTEST_POOL_LOCK(pool);
     cl->next = pool->cleanup;
     pool->cleanup = cl;
@@ -20,18 +20,51 @@ CTEST_CPP_START
 
 #define CTEST_POOL_ALIGNMENT         512
 #define CTEST_POOL_PAGE_SIZE         4096
+#define CTEST_POOL_FLAG_LOCK         0x01
+#define CTEST_POOL_FLAG_CONCURRENT   0x02
+#define CTEST_POOL_FLAG_MMAP         0x04
+#define CTEST_POOL_FLAG_HUGETLB      0x08
+#define CTEST_POOL_FLAG_THP          0x10
+#define CTEST_POOL_FLAG_REGISTERED   0x20
+#define CTEST_POOL_FLAG_CHILD        0x40
+#define CTEST_POOL_FLAG_FROM_LARGE   0x80
+#define CTEST_POOL_HUGE_PAGE_SIZE    (2 * 1024 * 1024)
+#define CTEST_POOL_MAX_BLOCK_SIZE    (1024 * 1024)
+#define CTEST_POOL_SCAN_BLOCKS       4
+#define CTEST_POOL_LARGE_CACHE       4
+#define CTEST_POOL_ZERO_MIN          65536
+#define CTEST_POOL_MAGIC_LARGE       0x4752414c
+#define CTEST_POOL_CHUNK_SIZE        2048
+#define CTEST_POOL_TLS_SLOTS         4
+#define CTEST_POOL_CACHE_BUCKETS     25
+#define CTEST_POOL_MAGAZINE_SIZE     (1024 * 1024)
 #define ctest_pool_alloc(pool, size)  ctest_pool_alloc_ex(pool, size, sizeof(long))
 #define ctest_pool_nalloc(pool, size) ctest_pool_alloc_ex(pool, size, 1)
 
 typedef void *(*ctest_pool_realloc_pt)(void *ptr, size_t size);
 typedef struct ctest_pool_large_t ctest_pool_large_t;
 typedef struct ctest_pool_t ctest_pool_t;
+typedef struct ctest_pool_ext_t ctest_pool_ext_t;
 typedef void (ctest_pool_cleanup_pt)(const void *data);
 typedef struct ctest_pool_cleanup_t ctest_pool_cleanup_t;
+typedef struct ctest_pool_opt_t ctest_pool_opt_t;
+typedef struct ctest_pool_stat_t ctest_pool_stat_t;
+typedef struct ctest_pool_mark_t ctest_pool_mark_t;
 
+/**
+ * large的头紧挨着放在数据前面, 可以单独释放, alloc是分配时的allocator, 释放用它.
+ * size是整块的大小, offset是头到整块开头的距离, 对齐超过16时不为0
+ */
 struct ctest_pool_large_t {
     ctest_pool_large_t       *next;
-    uint8_t                 *data;
+    ctest_pool_large_t       *prev;
+    ctest_pool_realloc_pt    alloc;
+    uint32_t                size;
+    uint32_t                flags;
+    uint32_t                magic;
+    uint32_t                seq;
+    uint32_t                offset;
+    uint32_t                align;
 };
 
 struct ctest_pool_cleanup_t {
@@ -40,10 +73,25 @@ struct ctest_pool_cleanup_t {
     const void              *data;
 };
 
+/**
+ * first_size是第一个block的大小, block_size是第二个block的大小, 为0时和第一个一样,
+ * 之后每次翻倍, 直到max_block_size(为0时是CTEST_POOL_MAX_BLOCK_SIZE).
+ * flags: CTEST_POOL_FLAG_MMAP用mmap分配block, 加上HUGETLB或THP时按2M对齐,
+ * HUGETLB分不到大页时退回到THP(madvise)
+ */
+struct ctest_pool_opt_t {
+    uint32_t                first_size;
+    uint32_t                block_size;
+    uint32_t                max_block_size;
+    int                     flags;
+};
+
 struct ctest_pool_t {
     uint8_t                 *last;
     uint8_t                 *end;
+    uint8_t                 *zero;
     ctest_pool_t             *next;
+    ctest_pool_realloc_pt    alloc;
     uint16_t                failed;
     uint16_t                flags;
     uint32_t                max;
@@ -54,25 +102,89 @@ struct ctest_pool_t {
     ctest_atomic_t           ref;
     ctest_atomic_t           tlock;
     ctest_pool_cleanup_t     *cleanup;
+    uint64_t                gen;
+    uint32_t                block_size;
+    uint32_t                next_size;
+    uint32_t                max_block;
+    uint32_t                large_seq;
+    ctest_pool_t             *tail;
+    ctest_pool_t             *spare;
+
+    // 统计, 和分配在同一把锁下更新
+    int64_t                 requested;
+    int64_t                 align_waste;
+    int64_t                 peak;
+
+    // 不常用的字段, 用到时才分配
+    ctest_pool_ext_t         *ext;
 #ifdef CTEST_DEBUG_MAGIC
     uint64_t                magic;
 #endif
 };
 
+/**
+ * requested是clear以来申请的字节数, 并发模式下按chunk算, peak是它到过的最大值;
+ * abandoned是current前面那些block里用不上的空间.
+ * ctest_pool_stats_all不给没加锁的pool加锁, 只在调试时用
+ */
+struct ctest_pool_stat_t {
+    int64_t                 requested;
+    int64_t                 reserved;
+    int64_t                 peak;
+    int64_t                 align_waste;
+    int64_t                 abandoned;
+    int64_t                 free;
+    int64_t                 large_bytes;
+    int                     blocks;
+    int                     large_count;
+    int                     cleanups;
+    int                     pools;
+};
+
+/**
+ * ctest_pool_mark时的位置, ctest_pool_release回到这里;
+ * mark以后只在tail和之后新加的block上分配
+ */
+struct ctest_pool_mark_t {
+    ctest_pool_t             *current;
+    ctest_pool_t             *tail;
+    uint8_t                 *last;
+    ctest_pool_cleanup_t     *cleanup;
+    uint32_t                large_seq;
+    int64_t                 requested;
+};
+
 extern ctest_pool_realloc_pt ctest_pool_realloc;
 extern void *ctest_pool_default_realloc (void *ptr, size_t size);
 
 extern ctest_pool_t *ctest_pool_create(uint32_t size);
+extern ctest_pool_t *ctest_pool_create_ex(ctest_pool_opt_t *opt);
+extern ctest_pool_t *ctest_pool_create_child(ctest_pool_t *parent, uint32_t size);
 extern void ctest_pool_clear(ctest_pool_t *pool);
+extern void ctest_pool_reset(ctest_pool_t *pool);
+extern ctest_pool_mark_t ctest_pool_mark(ctest_pool_t *pool);
+extern void ctest_pool_release(ctest_pool_t *pool, ctest_pool_mark_t *mark);
 extern void ctest_pool_destroy(ctest_pool_t *pool);
 extern void *ctest_pool_alloc_ex(ctest_pool_t *pool, uint32_t size, int align);
 extern void *ctest_pool_calloc(ctest_pool_t *pool, uint32_t size);
+extern void *ctest_pool_calloc_array(ctest_pool_t *pool, uint32_t n, uint32_t size);
+extern void ctest_pool_free_large(ctest_pool_t *pool, void *ptr);
+extern void *ctest_pool_realloc_large(ctest_pool_t *pool, void *ptr, uint32_t size);
+extern void *ctest_pool_large_base(ctest_pool_t *pool, const void *ptr);
 extern void ctest_pool_set_allocator(ctest_pool_realloc_pt alloc);
 extern void ctest_pool_set_lock(ctest_pool_t *pool);
+extern void ctest_pool_set_concurrent(ctest_pool_t *pool);
+extern void ctest_pool_set_cache_limit(int64_t bytes);
+extern void ctest_pool_cache_flush();
 extern ctest_pool_cleanup_t *ctest_pool_cleanup_new(ctest_pool_t *pool, const void *data, ctest_pool_cleanup_pt *handler);
 extern void ctest_pool_cleanup_reg(ctest_pool_t *pool, ctest_pool_cleanup_t *cl);
 
 extern char *ctest_pool_strdup(ctest_pool_t *pool, const char *str);
 
+extern void ctest_pool_stats(ctest_pool_t *pool, ctest_pool_stat_t *st);
+extern void ctest_pool_set_registry(int enable);
+extern void ctest_pool_stats_all(ctest_pool_stat_t *st);
+extern void ctest_pool_print_stats(ctest_pool_stat_t *st, FILE *fp);
+
 CTEST_CPP_END
 #endif
@@ -0,0 +1,138 @@
+#ifndef CTEST_POOL_HPP_
+#define CTEST_POOL_HPP_
+
+/**
+ * C++里用ctest_pool_t: STL的allocator和std::pmr::memory_resource.
+ * 小块的deallocate什么都不做, 在ctest_pool_clear时一起释放;
+ * large的直接还给pool, vector扩容不会一直占着旧的
+ */
+#include "ctest_pool.h"
+#include <new>
+#include <cstddef>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define CTEST_POOL_HAS_PMR 1
+#endif
+#endif
+
+namespace ctest_pool_cxx {
+
+// pool里算上头和对齐, 总大小不能超过uint32
+static inline void *allocate(ctest_pool_t *pool, size_t bytes, size_t align)
+{
+    void                    *p;
+
+    if (bytes + align + sizeof(ctest_pool_large_t) > UINT32_MAX
+            || (p = ctest_pool_alloc_ex(pool, (uint32_t)bytes, (int)align)) == NULL)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+/**
+ * 和ctest_pool_alloc_shared走large的条件一样, pool->max在两次clear之间只会变大,
+ * 现在还满足的一定是large, 对齐超过16的large头也在数据前面, 可以直接还
+ */
+static inline void deallocate(ctest_pool_t *pool, void *p, size_t bytes, size_t align)
+{
+    if (p && (bytes > pool->max || (align > 16 && bytes + align > pool->max)))
+        ctest_pool_free_large(pool, p);
+}
+
+}
+
+template <typename T>
+class ctest_pool_allocator
+{
+public:
+    typedef T               value_type;
+    typedef T               *pointer;
+    typedef const T         *const_pointer;
+    typedef T               &reference;
+    typedef const T         &const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template <typename U> struct rebind {
+        typedef ctest_pool_allocator<U> other;
+    };
+
+    explicit ctest_pool_allocator(ctest_pool_t *pool) : pool_(pool) {}
+    template <typename U> ctest_pool_allocator(const ctest_pool_allocator<U> &o) : pool_(o.pool()) {}
+
+    T *allocate(size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_alloc();
+
+        return (T *)ctest_pool_cxx::allocate(pool_, n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        ctest_pool_cxx::deallocate(pool_, p, n * sizeof(T), alignof(T));
+    }
+
+    ctest_pool_t *pool() const
+    {
+        return pool_;
+    }
+
+private:
+    ctest_pool_t             *pool_;
+};
+
+template <typename T, typename U>
+static inline bool operator==(const ctest_pool_allocator<T> &a, const ctest_pool_allocator<U> &b)
+{
+    return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+static inline bool operator!=(const ctest_pool_allocator<T> &a, const ctest_pool_allocator<U> &b)
+{
+    return a.pool() != b.pool();
+}
+
+#ifdef CTEST_POOL_HAS_PMR
+class ctest_pool_resource : public std::pmr::memory_resource
+{
+public:
+    explicit ctest_pool_resource(ctest_pool_t *pool) : pool_(pool) {}
+
+    ctest_pool_t *pool() const
+    {
+        return pool_;
+    }
+
+    // 所有分配出去的一起释放
+    void release()
+    {
+        ctest_pool_clear(pool_);
+    }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override
+    {
+        return ctest_pool_cxx::allocate(pool_, bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override
+    {
+        ctest_pool_cxx::deallocate(pool_, p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &o) const noexcept override
+    {
+        const ctest_pool_resource *r = dynamic_cast<const ctest_pool_resource *>(&o);
+        return (r && r->pool_ == pool_);
+    }
+
+private:
+    ctest_pool_t             *pool_;
+};
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+#include "ctest_profile.h"
+#include <signal.h>
+#include <sys/time.h>
+
+/**
+ * 信号处理里只做backtrace写到预分配的buffer, 符号化放到dump时做
+ */
+
+// 跳过ctest_profile_handler和signal trampoline
+#define CTEST_PROFILE_SKIP           2
+
+static ctest_profile_sample_t *ctest_profile_samples = NULL;
+static ctest_atomic32_t      ctest_profile_nsample = 0;
+static ctest_atomic32_t      ctest_profile_dropped = 0;
+static int                  ctest_profile_hz = CTEST_PROFILE_DEFAULT_HZ;
+static int                  ctest_profile_running = 0;
+static struct sigaction     ctest_profile_oldact;
+
+static void ctest_profile_handler(int sig);
+static int ctest_profile_sample_cmp(const void *a, const void *b);
+static int ctest_profile_pc_cmp(const void *a, const void *b);
+static char *ctest_profile_symbol(char *sym);
+
+/**
+ * 分配采样buffer, 必须在start之前调用
+ */
+int ctest_profile_init(int hz)
+{
+    void                    *pc[1];
+
+    if (ctest_profile_samples == NULL) {
+        ctest_profile_samples = (ctest_profile_sample_t *)ctest_malloc(
+                                    CTEST_PROFILE_MAX_SAMPLES * sizeof(ctest_profile_sample_t));
+
+        if (ctest_profile_samples == NULL)
+            return CTEST_ERROR;
+    }
+
+    ctest_profile_hz = (hz > 0 ? hz : CTEST_PROFILE_DEFAULT_HZ);
+
+    // 第一次backtrace会加载libgcc_s, 不能放在信号处理里
+    backtrace(pc, 1);
+
+    return CTEST_OK;
+}
+
+void ctest_profile_destroy()
+{
+    ctest_profile_stop();
+    ctest_free(ctest_profile_samples);
+    ctest_profile_samples = NULL;
+}
+
+int ctest_profile_start()
+{
+    struct sigaction        act;
+    struct itimerval        timer;
+
+    if (ctest_profile_samples == NULL)
+        return CTEST_ERROR;
+
+    ctest_profile_nsample = 0;
+    ctest_profile_dropped = 0;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = ctest_profile_handler;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+
+    if (sigaction(SIGPROF, &act, &ctest_profile_oldact) != 0)
+        return CTEST_ERROR;
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / ctest_profile_hz;
+    timer.it_value = timer.it_interval;
+
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &ctest_profile_oldact, NULL);
+        return CTEST_ERROR;
+    }
+
+    ctest_profile_running = 1;
+    return CTEST_OK;
+}
+
+void ctest_profile_stop()
+{
+    struct itimerval        timer;
+
+    if (ctest_profile_running == 0)
+        return;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &ctest_profile_oldact, NULL);
+    ctest_profile_running = 0;
+}
+
+/**
+ * 把采样结果按collapsed stacks格式写到filename, 每行: root;...;leaf count
+ */
+int ctest_profile_dump(const char *filename)
+{
+    FILE                    *fp;
+    ctest_profile_sample_t   *s, *prev;
+    void                    **pcs, **pc;
+    char                    **syms;
+    int                     i, j, n, npc, count;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        return CTEST_ERROR;
+
+    n = ctest_min(ctest_profile_nsample, CTEST_PROFILE_MAX_SAMPLES);
+    pcs = NULL;
+    syms = NULL;
+
+    if (n <= 0)
+        goto out;
+
+    // 相同的栈排到一起
+    qsort(ctest_profile_samples, n, sizeof(ctest_profile_sample_t), ctest_profile_sample_cmp);
+
+    // 去重后的pc一次性符号化
+    if ((pcs = (void **)ctest_malloc(n * CTEST_PROFILE_MAX_DEPTH * sizeof(void *))) == NULL)
+        goto out;
+
+    for(i = npc = 0; i < n; i++) {
+        s = ctest_profile_samples + i;
+
+        for(j = CTEST_PROFILE_SKIP; j < s->depth; j++)
+            pcs[npc++] = s->pc[j];
+    }
+
+    qsort(pcs, npc, sizeof(void *), ctest_profile_pc_cmp);
+
+    for(i = j = 0; i < npc; i++) {
+        if (j == 0 || pcs[j - 1] != pcs[i])
+            pcs[j++] = pcs[i];
+    }
+
+    npc = j;
+
+    if (npc > 0 && (syms = backtrace_symbols(pcs, npc)) == NULL)
+        goto out;
+
+    for(i = 0; i < npc; i++)
+        syms[i] = ctest_profile_symbol(syms[i]);
+
+    // 输出, root在前
+    for(i = 0, prev = NULL, count = 0; i <= n; i++) {
+        s = (i < n ? ctest_profile_samples + i : NULL);
+
+        if (prev && s && ctest_profile_sample_cmp(prev, s) == 0) {
+            count ++;
+            continue;
+        }
+
+        if (prev && prev->depth > CTEST_PROFILE_SKIP) {
+            for(j = prev->depth - 1; j >= CTEST_PROFILE_SKIP; j--) {
+                pc = (void **)bsearch(&prev->pc[j], pcs, npc, sizeof(void *), ctest_profile_pc_cmp);
+
+                if (syms[pc - pcs][0])
+                    fprintf(fp, "%s%s", syms[pc - pcs], (j > CTEST_PROFILE_SKIP ? ";" : ""));
+                else
+                    fprintf(fp, "%p%s", prev->pc[j], (j > CTEST_PROFILE_SKIP ? ";" : ""));
+            }
+
+            fprintf(fp, " %d\n", count);
+        }
+
+        prev = s;
+        count = 1;
+    }
+
+    if (ctest_profile_dropped > 0)
+        fprintf(stderr, "profile: %d samples dropped for %s\n", (int)ctest_profile_dropped, filename);
+
+out:
+    ctest_free(syms);
+    ctest_free(pcs);
+    fclose(fp);
+    return CTEST_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void ctest_profile_handler(int sig)
+{
+    ctest_profile_sample_t   *s;
+    int                     idx, olderrno = errno;
+
+    idx = ctest_atomic32_add_return(&ctest_profile_nsample, 1) - 1;
+
+    if (likely(idx < CTEST_PROFILE_MAX_SAMPLES)) {
+        s = ctest_profile_samples + idx;
+        s->depth = backtrace(s->pc, CTEST_PROFILE_MAX_DEPTH);
+    } else {
+        ctest_atomic32_inc(&ctest_profile_dropped);
+    }
+
+    errno = olderrno;
+}
+
+static int ctest_profile_sample_cmp(const void *a, const void *b)
+{
+    const ctest_profile_sample_t *sa = (const ctest_profile_sample_t *)a;
+    const ctest_profile_sample_t *sb = (const ctest_profile_sample_t *)b;
+
+    if (sa->depth != sb->depth)
+        return (sa->depth < sb->depth ? -1 : 1);
+
+    return memcmp(sa->pc, sb->pc, sa->depth * sizeof(void *));
+}
+
+static int ctest_profile_pc_cmp(const void *a, const void *b)
+{
+    uintptr_t               pa = (uintptr_t) * (void **)a;
+    uintptr_t               pb = (uintptr_t) * (void **)b;
+
+    return (pa < pb ? -1 : (pa > pb ? 1 : 0));
+}
+
+/**
+ * "binary(func+0x1a) [0x4005d6]" => "func", 没有符号返回""
+ */
+static char *ctest_profile_symbol(char *sym)
+{
+    char                    *start, *end;
+
+    if ((start = strchr(sym, '(')) == NULL)
+        return (char *)"";
+
+    start ++;
+
+    for(end = start; *end && *end != '+' && *end != ')'; end++) {
+        if (*end == ';' || *end == ' ')
+            *end = '_';
+    }
+
+    *end = '\0';
+    return start;
+}
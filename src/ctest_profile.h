@@ -0,0 +1,31 @@
+#ifndef CTEST_PROFILE_H_
+#define CTEST_PROFILE_H_
+
+/**
+ * 基于SIGPROF的采样profiler, 输出collapsed stacks(flame graph)
+ */
+#include "ctest_define.h"
+#include "ctest_atomic.h"
+
+CTEST_CPP_START
+
+#define CTEST_PROFILE_MAX_DEPTH      48
+#define CTEST_PROFILE_MAX_SAMPLES    8192
+#define CTEST_PROFILE_DEFAULT_HZ     997
+
+typedef struct ctest_profile_sample_t ctest_profile_sample_t;
+
+struct ctest_profile_sample_t {
+    int                     depth;
+    void                    *pc[CTEST_PROFILE_MAX_DEPTH];
+};
+
+extern int ctest_profile_init(int hz);
+extern void ctest_profile_destroy();
+extern int ctest_profile_start();
+extern void ctest_profile_stop();
+extern int ctest_profile_dump(const char *filename);
+
+CTEST_CPP_END
+
+#endif
@@ -0,0 +1,430 @@
+#include "ctest_prop.h"
+#include "ctest_string.h"
+#include <sys/wait.h>
+
+/**
+ * 每个case由seed生成一串choice, 失败以后在choice上做删除和减小,
+ * 重放得到更小的反例; jobs > 1时fork多个进程分段生成
+ */
+
+int                         ctest_prop_cases = CTEST_PROP_DEFAULT_CASES;
+int                         ctest_prop_jobs = 1;
+uint64_t                    ctest_prop_seed = 0;
+
+static uint64_t ctest_prop_next(uint64_t *s);
+static uint64_t ctest_prop_choice(ctest_prop_t *prop, uint64_t range);
+static int ctest_prop_exec(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args);
+static int64_t ctest_prop_search(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args,
+                                 uint64_t base, int from, int step);
+static int64_t ctest_prop_search_fork(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args,
+                                      uint64_t base);
+static int ctest_prop_shrink(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args);
+static int ctest_prop_try(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args,
+                          uint64_t *best, int *nbest);
+
+/**
+ * 跑一个property, 失败返回CTEST_ERROR, 并且用最小反例再跑一次(show=1)把错误打印出来
+ */
+int ctest_prop_run(const char *name, ctest_prop_check_pt *check, void *args)
+{
+    ctest_prop_t             *prop;
+    uint64_t                base, seed;
+    int64_t                 idx;
+    int                     steps, ret = CTEST_OK;
+
+    if ((prop = (ctest_prop_t *)ctest_malloc(sizeof(ctest_prop_t))) == NULL)
+        return CTEST_ERROR;
+
+    memset(prop, 0, sizeof(ctest_prop_t));
+
+    if ((prop->pool = ctest_pool_create(CTEST_POOL_PAGE_SIZE)) == NULL) {
+        ctest_free(prop);
+        return CTEST_ERROR;
+    }
+
+    // --prop-seed: 只重放这一个seed
+    if (ctest_prop_seed) {
+        seed = prop->seed = ctest_prop_seed;
+        idx = (ctest_prop_exec(prop, check, args) ? 0 : -1);
+    } else {
+        base = ((uint64_t)time(NULL) << 20) ^ ((uint64_t)getpid() << 40) ^ (uint64_t)(uintptr_t)name;
+
+        if (ctest_prop_jobs > 1)
+            idx = ctest_prop_search_fork(prop, check, args, base);
+        else
+            idx = ctest_prop_search(prop, check, args, base, 0, 1);
+
+        seed = base + idx;
+        seed = ctest_prop_next(&seed);
+    }
+
+    if (idx >= 0) {
+        prop->seed = seed;
+        ctest_prop_exec(prop, check, args);
+        steps = ctest_prop_shrink(prop, check, args);
+
+        printf("PROP %s falsified after %" PRId64 " cases, shrunk %d steps to %d choices, "
+               "replay with --prop-seed=0x%" PRIx64 "\n", name, idx + 1, steps, prop->nreplay, seed);
+
+        // 最小反例, 打印生成的值和断言
+        prop->replay = 1;
+        prop->show = 1;
+        ctest_prop_exec(prop, check, args);
+        ret = CTEST_ERROR;
+    }
+
+    ctest_pool_destroy(prop->pool);
+    ctest_free(prop);
+    return ret;
+}
+
+/**
+ * [lo, hi]的整数, choice越小越靠近0
+ */
+int64_t ctest_prop_int(ctest_prop_t *prop, int64_t lo, int64_t hi)
+{
+    uint64_t                k, o, up, down, m;
+    int64_t                 v;
+
+    if (lo > hi) return lo;
+
+    o = (uint64_t)(lo > 0 ? lo : (hi < 0 ? hi : 0));
+    up = (uint64_t)hi - o;
+    down = o - (uint64_t)lo;
+    k = ctest_prop_choice(prop, (uint64_t)hi - (uint64_t)lo + 1);
+    m = ctest_min(up, down);
+
+    // o, o+1, o-1, o+2, o-2 ... 一边用完以后只往另一边走
+    if (k <= 2 * m)
+        v = (int64_t)((k & 1) ? o + (k + 1) / 2 : o - k / 2);
+    else if (up > down)
+        v = (int64_t)(o + (k - m));
+    else
+        v = (int64_t)(o - (k - m));
+
+    if (prop->show)
+        printf("  prop[%d] = %" PRId64 "\n", prop->nchoice - 1, v);
+
+    return v;
+}
+
+/**
+ * 长度在[minlen, maxlen]之间的字节串, 从pool上分配, 末尾补0
+ */
+char *ctest_prop_bytes(ctest_prop_t *prop, int minlen, int maxlen, int *len)
+{
+    char                    *data, hex[68];
+    int                     i, n, show;
+
+    show = prop->show;
+    prop->show = 0;
+    n = minlen + (int)ctest_prop_choice(prop, maxlen - minlen + 1);
+
+    if ((data = (char *)ctest_pool_nalloc(prop->pool, n + 1)) == NULL) {
+        n = 0;
+        data = (char *)"";
+    } else {
+        for(i = 0; i < n; i++)
+            data[i] = (char)ctest_prop_choice(prop, 256);
+
+        data[n] = '\0';
+    }
+
+    prop->show = show;
+
+    if (show)
+        printf("  bytes(%d) = %s%s\n", n, ctest_string_tohex(data, n, hex, sizeof(hex)), (n > 33 ? "..." : ""));
+
+    if (len) *len = n;
+
+    return data;
+}
+
+/**
+ * 可打印字符, choice为0时是'a'
+ */
+ctest_buf_string_t ctest_prop_string(ctest_prop_t *prop, int maxlen)
+{
+    ctest_buf_string_t       s;
+    int                     i, show;
+
+    show = prop->show;
+    prop->show = 0;
+    s.len = (int)ctest_prop_choice(prop, maxlen + 1);
+
+    if ((s.data = (char *)ctest_pool_nalloc(prop->pool, s.len + 1)) == NULL) {
+        s.data = (char *)"";
+        s.len = 0;
+    } else {
+        for(i = 0; i < s.len; i++)
+            s.data[i] = (char)(' ' + (ctest_prop_choice(prop, 95) + 65) % 95);
+
+        s.data[s.len] = '\0';
+    }
+
+    prop->show = show;
+
+    if (show)
+        printf("  string(%d) = \"%.*s\"\n", s.len, s.len, s.data);
+
+    return s;
+}
+
+/**
+ * 最多maxn个[lo, hi]的整数
+ */
+int64_t *ctest_prop_array(ctest_prop_t *prop, int64_t lo, int64_t hi, int maxn, int *n)
+{
+    int64_t                 *a;
+    int                     i, cnt, show;
+
+    show = prop->show;
+    prop->show = 0;
+    cnt = (int)ctest_prop_choice(prop, maxn + 1);
+
+    if ((a = (int64_t *)ctest_pool_alloc(prop->pool, (cnt ? cnt : 1) * sizeof(int64_t))) == NULL)
+        cnt = 0;
+
+    for(i = 0; i < cnt; i++)
+        a[i] = ctest_prop_int(prop, lo, hi);
+
+    prop->show = show;
+
+    if (show) {
+        printf("  array(%d) = {", cnt);
+
+        for(i = 0; i < cnt; i++)
+            printf("%s%" PRId64, (i ? ", " : ""), a[i]);
+
+        printf("}\n");
+    }
+
+    if (n) *n = cnt;
+
+    return a;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// splitmix64
+static uint64_t ctest_prop_next(uint64_t *s)
+{
+    uint64_t                z = (*s += __UINT64_C(0x9E3779B97F4A7C15));
+
+    z = (z ^ (z >> 30)) * __UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * __UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/**
+ * 取一个[0, range)的choice, range为0表示2^64; 生成时偏向边界值
+ */
+static uint64_t ctest_prop_choice(ctest_prop_t *prop, uint64_t range)
+{
+    uint64_t                k, r;
+
+    if (unlikely(prop->nchoice >= CTEST_PROP_MAX_CHOICES))
+        return 0;
+
+    if (prop->replay) {
+        k = (prop->nchoice < prop->nreplay ? prop->replays[prop->nchoice] : 0);
+
+        if (range && k >= range) k %= range;
+    } else {
+        r = ctest_prop_next(&prop->rnd);
+
+        if ((r & 15) == 0)
+            k = ((r >> 4) & 1) ? range - 1 - ((r >> 5) & 1) : ((r >> 5) & 1);
+        else
+            k = ctest_prop_next(&prop->rnd);
+
+        if (range) k %= range;
+    }
+
+    prop->choices[prop->nchoice++] = k;
+    return k;
+}
+
+static int ctest_prop_exec(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args)
+{
+    ctest_pool_clear(prop->pool);
+    prop->rnd = prop->seed;
+    prop->nchoice = 0;
+    return (*check)(prop, args);
+}
+
+/**
+ * 跑第from, from+step, ...个case, 返回第一个失败的序号
+ */
+static int64_t ctest_prop_search(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args,
+                                 uint64_t base, int from, int step)
+{
+    uint64_t                s;
+    int                     i;
+
+    prop->replay = 0;
+
+    for(i = from; i < ctest_prop_cases; i += step) {
+        s = base + i;
+        prop->seed = ctest_prop_next(&s);
+
+        if (ctest_prop_exec(prop, check, args))
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * fork ctest_prop_jobs个进程, 每个跑一部分, 通过pipe返回第一个失败的序号;
+ * 只等自己fork的, 测试进程可能还有别的子进程(death test的zygote)
+ */
+static int64_t ctest_prop_search_fork(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args,
+                                      uint64_t base)
+{
+    int64_t                 idx, ret = -1;
+    pid_t                   *pids;
+    int                     i, fd[2];
+
+    if ((pids = (pid_t *)ctest_malloc(ctest_prop_jobs * sizeof(pid_t))) == NULL)
+        return ctest_prop_search(prop, check, args, base, 0, 1);
+
+    if (pipe(fd) != 0) {
+        ctest_free(pids);
+        return ctest_prop_search(prop, check, args, base, 0, 1);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for(i = 0; i < ctest_prop_jobs; i++) {
+        if ((pids[i] = fork()) == 0) {
+            close(fd[0]);
+            idx = ctest_prop_search(prop, check, args, base, i, ctest_prop_jobs);
+
+            if (write(fd[1], &idx, sizeof(idx)) != sizeof(idx))
+                _exit(1);
+
+            _exit(0);
+        }
+
+        // fork不了的部分自己跑
+        if (pids[i] < 0) {
+            idx = ctest_prop_search(prop, check, args, base, i, ctest_prop_jobs);
+
+            if (write(fd[1], &idx, sizeof(idx)) != sizeof(idx))
+                idx = -1;
+        }
+    }
+
+    close(fd[1]);
+
+    while(read(fd[0], &idx, sizeof(idx)) == sizeof(idx)) {
+        if (idx >= 0 && (ret < 0 || idx < ret))
+            ret = idx;
+    }
+
+    close(fd[0]);
+
+    for(i = 0; i < ctest_prop_jobs; i++) {
+        if (pids[i] > 0) waitpid(pids[i], NULL, 0);
+    }
+
+    ctest_free(pids);
+    return ret;
+}
+
+/**
+ * 删除一段choice, 或者把一个choice变小, 只要还失败就接受; 返回接受的次数
+ */
+static int ctest_prop_shrink(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args)
+{
+    uint64_t                *best, lo, hi, mid, orig, base, step;
+    int                     i, size, nbest, steps, changed, tries;
+
+    best = (uint64_t *)ctest_malloc(sizeof(uint64_t) * CTEST_PROP_MAX_CHOICES);
+    nbest = prop->nchoice;
+    memcpy(best, prop->choices, nbest * sizeof(uint64_t));
+    steps = tries = 0;
+
+    do {
+        changed = 0;
+
+        for(size = 8; size > 0 && tries < CTEST_PROP_MAX_SHRINKS; size /= 2) {
+            for(i = nbest - size; i >= 0 && tries < CTEST_PROP_MAX_SHRINKS; i--, tries++) {
+                memcpy(prop->replays, best, i * sizeof(uint64_t));
+                memcpy(prop->replays + i, best + i + size, (nbest - i - size) * sizeof(uint64_t));
+                prop->nreplay = nbest - size;
+
+                if (ctest_prop_try(prop, check, args, best, &nbest)) {
+                    steps ++;
+                    changed = 1;
+                    i = ctest_min(i, nbest - size + 1);
+                }
+            }
+        }
+
+        for(i = 0; i < nbest && tries < CTEST_PROP_MAX_SHRINKS; i++) {
+            orig = best[i];
+
+            // 二分找最小的还失败的值, 先保持奇偶(整数的正负)不变, 再不限制
+            for(step = 2; step > 0; step--) {
+                base = orig % step;
+                lo = 0;
+                hi = best[i] / step;
+
+                while(lo < hi && i < nbest && best[i] == base + hi * step && tries < CTEST_PROP_MAX_SHRINKS) {
+                    mid = lo + (hi - lo) / 2;
+                    memcpy(prop->replays, best, nbest * sizeof(uint64_t));
+                    prop->replays[i] = base + mid * step;
+                    prop->nreplay = nbest;
+                    tries ++;
+
+                    if (ctest_prop_try(prop, check, args, best, &nbest))
+                        hi = mid;
+                    else
+                        lo = mid + 1;
+                }
+
+                if (i >= nbest) break;
+            }
+
+            if (i < nbest && best[i] != orig) {
+                steps ++;
+                changed = 1;
+            }
+        }
+    } while(changed && tries < CTEST_PROP_MAX_SHRINKS);
+
+    memcpy(prop->replays, best, nbest * sizeof(uint64_t));
+    prop->nreplay = nbest;
+    ctest_free(best);
+    return steps;
+}
+
+/**
+ * 重放replays, 还失败并且choice序列更小(短的优先, 再按字典序)时更新best
+ */
+static int ctest_prop_try(ctest_prop_t *prop, ctest_prop_check_pt *check, void *args,
+                          uint64_t *best, int *nbest)
+{
+    int                     i;
+
+    prop->replay = 1;
+
+    if (ctest_prop_exec(prop, check, args) == 0)
+        return 0;
+
+    if (prop->nchoice > *nbest)
+        return 0;
+
+    if (prop->nchoice == *nbest) {
+        for(i = 0; i < *nbest && prop->choices[i] == best[i]; i++);
+
+        if (i == *nbest || prop->choices[i] > best[i])
+            return 0;
+    }
+
+    memcpy(best, prop->choices, prop->nchoice * sizeof(uint64_t));
+    *nbest = prop->nchoice;
+    return 1;
+}
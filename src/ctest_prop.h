@@ -0,0 +1,48 @@
+#ifndef CTEST_PROP_H_
+#define CTEST_PROP_H_
+
+/**
+ * property-based testing, 生成器都从一串choice里取值,
+ * 缩小(shrink)时只缩小这串choice, 所以对所有生成器通用
+ */
+#include "ctest_define.h"
+#include "ctest_pool.h"
+#include "ctest_buf.h"
+
+CTEST_CPP_START
+
+#define CTEST_PROP_MAX_CHOICES       4096
+#define CTEST_PROP_DEFAULT_CASES     1000
+#define CTEST_PROP_MAX_SHRINKS       20000
+
+typedef struct ctest_prop_t ctest_prop_t;
+// 返回非0表示失败
+typedef int (ctest_prop_check_pt)(ctest_prop_t *prop, void *args);
+
+struct ctest_prop_t {
+    ctest_pool_t             *pool;
+    uint64_t                seed;
+    uint64_t                rnd;
+    int                     replay;
+    int                     show;
+    int                     nchoice;
+    int                     nreplay;
+    uint64_t                choices[CTEST_PROP_MAX_CHOICES];
+    uint64_t                replays[CTEST_PROP_MAX_CHOICES];
+};
+
+extern int ctest_prop_cases;
+extern int ctest_prop_jobs;
+extern uint64_t ctest_prop_seed;
+
+extern int ctest_prop_run(const char *name, ctest_prop_check_pt *check, void *args);
+
+// 生成器
+extern int64_t ctest_prop_int(ctest_prop_t *prop, int64_t lo, int64_t hi);
+extern char *ctest_prop_bytes(ctest_prop_t *prop, int minlen, int maxlen, int *len);
+extern ctest_buf_string_t ctest_prop_string(ctest_prop_t *prop, int maxlen);
+extern int64_t *ctest_prop_array(ctest_prop_t *prop, int64_t lo, int64_t hi, int maxn, int *n);
+
+CTEST_CPP_END
+
+#endif
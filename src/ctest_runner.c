@@ -0,0 +1,1108 @@
+#include "ctest_pool.h"
+#include "ctest_list.h"
+#include "ctest_hash.h"
+#include "ctest_string.h"
+#include "ctest_trace.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/**
+ * 多个测试程序一起跑: 每个程序用-l列出测试, 合并成一个队列,
+ * 分到N个slot上并行执行, 每个测试的输出整块打印, 最后合并汇总
+ *
+ * ctest-runner [-j N] [-f [-]filter] [--cache-dir=dir] binary... [-- args]
+ *
+ * 打开--cache-dir后, 每个测试按(build-id, 依赖的so, 环境变量白名单, 参数, 测试名)
+ * 算一个key, 已经pass过的测试直接跳过, 报告为cached
+ *
+ * --watch: 跑完后用inotify盯着runner自己, 测试程序和--watch-path目录,
+ * 有变化就re-exec, 只重跑上次失败的测试(有filter时再加上filter匹配的)
+ *
+ * --connect=sock: 不启动测试程序, 把filter和参数发给常驻的test_main --serve=sock
+ *
+ * --trace=file(或者参数里的--trace=file): 每个测试进程写file.N, 跑完合并成一个,
+ * pid都用runner的, tid是slot, 这样各个slot在时间线上排成一行一行
+ */
+
+#define CTEST_RUNNER_COLOR_RED       1
+#define CTEST_RUNNER_COLOR_GREEN     2
+#define CTEST_RUNNER_MAX_SLOT        256
+#define CTEST_RUNNER_MAX_ENV         64
+#define CTEST_RUNNER_DIGEST_SIZE     33
+#define CTEST_RUNNER_MAX_WATCH       64
+#define CTEST_RUNNER_STATE_ENV       "CTEST_RUNNER_STATE"
+#define CTEST_RUNNER_WATCH_MASK      (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB)
+
+typedef struct ctest_runner_bin_t ctest_runner_bin_t;
+typedef struct ctest_runner_job_t ctest_runner_job_t;
+typedef struct ctest_runner_t ctest_runner_t;
+
+struct ctest_runner_bin_t {
+    const char              *path;
+    ctest_list_t             node;
+    int                     test_cnt;
+    char                    digest[CTEST_RUNNER_DIGEST_SIZE];
+};
+
+struct ctest_runner_job_t {
+    ctest_runner_bin_t       *bin;
+    char                    *name;
+    ctest_list_t             node;
+    pid_t                   pid;
+    int                     fd;
+    int                     slot;
+    int                     status;
+    int64_t                 start;
+    char                    *out;
+    int                     out_len;
+    int                     out_size;
+    int                     cached;
+    char                    *trace_env;
+};
+
+struct ctest_runner_t {
+    ctest_pool_t             *pool;
+    ctest_list_t             bin_list;
+    ctest_list_t             queue;
+    ctest_list_t             done;
+    ctest_runner_job_t       *slots[CTEST_RUNNER_MAX_SLOT];
+    int                     slot_cnt;
+    int                     running;
+    const char              *filter_str;
+    int                     filter_str_len;
+    int                     filter_flags;
+    char                    **args;
+    int                     arg_cnt;
+    int                     total_cnt;
+    int                     failed_cnt;
+    int                     cached_cnt;
+    const char              *cache_dir;
+    const char              *cache_env[CTEST_RUNNER_MAX_ENV];
+    int                     cache_env_cnt;
+    int                     watch;
+    const char              *watch_path[CTEST_RUNNER_MAX_WATCH];
+    int                     watch_path_cnt;
+    const char              *filter_arg;
+    const char              *connect_path;
+    const char              *trace_file;
+    int                     trace_cnt;
+};
+
+static void ctest_runner_color_printf(int color, const char *fmt, ...)
+{
+    va_list                 args;
+    va_start(args, fmt);
+    printf("\033[0;3%dm", color);
+    vprintf(fmt, args);
+    printf("\033[m");
+    va_end(args);
+}
+
+static int64_t ctest_runner_now()
+{
+    struct timeval          tv;
+    gettimeofday (&tv, 0);
+    return 1000L * tv.tv_sec + tv.tv_usec / 1000;
+}
+
+static void ctest_runner_print_usage(char *prog_name)
+{
+    fprintf(stderr, "%s [-j N] [-f [-]filter_string] binary... [-- args]\n"
+            "    -j, --jobs              number of parallel slots\n"
+            "    -f, --filter            filter string\n"
+            "        --cache-dir=dir     skip tests that already passed with the same key\n"
+            "        --cache-env=NAME    environment variable that is part of the key\n"
+            "        --watch             rerun failed tests when binaries change\n"
+            "        --watch-path=dir    also rerun when something in dir changes\n"
+            "        --connect=sock      run in a resident test binary started with --serve\n"
+            "        --trace=file        merge chrome trace-event json of all tests into file\n"
+            "    -h, --help              display this help and exit\n\n", prog_name);
+}
+
+/**
+ * 和ctest_test_is_skip一样的规则
+ */
+static int ctest_runner_is_skip(ctest_runner_t *r, const char *str)
+{
+    int                     ret;
+
+    if (r->filter_str_len > 0)
+        ret = strncmp(r->filter_str, str, r->filter_str_len);
+    else if (r->filter_str_len < 0)
+        ret = strcmp(r->filter_str, str);
+    else
+        return 0;
+
+    return ((ret != 0 && r->filter_flags == 0) || (ret == 0 && r->filter_flags != 0));
+}
+
+/**
+ * fork一个子进程执行: bin args... extra, stdout和stderr都写到返回的fd
+ */
+static pid_t ctest_runner_spawn(ctest_runner_t *r, const char *bin, const char *extra1,
+                               const char *extra2, int slot, char *env, int *fd)
+{
+    int                     pfd[2], i, n;
+    char                    **argv, buffer[32];
+    pid_t                   pid;
+
+    if (pipe(pfd) != 0)
+        return -1;
+
+    if ((pid = fork()) < 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        argv = (char **)ctest_malloc((r->arg_cnt + 4) * sizeof(char *));
+        n = 0;
+        argv[n++] = (char *)bin;
+
+        for(i = 0; i < r->arg_cnt; i++)
+            argv[n++] = r->args[i];
+
+        if (extra1) argv[n++] = (char *)extra1;
+
+        if (extra2) argv[n++] = (char *)extra2;
+
+        argv[n] = NULL;
+
+        snprintf(buffer, sizeof(buffer), "%d", slot);
+        setenv("CTEST_WORKER_ID", buffer, 1);
+
+        if (env) putenv(env);
+
+        dup2(pfd[1], STDOUT_FILENO);
+        dup2(pfd[1], STDERR_FILENO);
+        close(pfd[0]);
+        close(pfd[1]);
+        execv(bin, argv);
+        fprintf(stderr, "exec %s: %s\n", bin, strerror(errno));
+        _exit(127);
+    }
+
+    close(pfd[1]);
+    *fd = pfd[0];
+    return pid;
+}
+
+static int ctest_runner_read(ctest_runner_job_t *job)
+{
+    char                    *p;
+    int                     n;
+
+    if (job->out_size - job->out_len < 4096) {
+        n = ctest_max(job->out_size * 2, 8192);
+
+        if ((p = (char *)ctest_realloc(job->out, n)) == NULL)
+            return CTEST_ERROR;
+
+        job->out = p;
+        job->out_size = n;
+    }
+
+    while ((n = read(job->fd, job->out + job->out_len, job->out_size - job->out_len - 1)) < 0) {
+        if (errno != EINTR)
+            return CTEST_ERROR;
+    }
+
+    job->out_len += n;
+    job->out[job->out_len] = '\0';
+    return n;
+}
+
+/**
+ * bin -l, 把"  case.func"加到队列; 重名的TEST用-f跑一次就都跑了, 只排一次
+ */
+static int ctest_runner_list(ctest_runner_t *r, ctest_runner_bin_t *bin)
+{
+    ctest_runner_job_t       list, *job;
+    ctest_hash_t             *names;
+    ctest_hash_list_t        *node;
+    char                    *line, *next;
+    uint64_t                key;
+    int                     n, status;
+    pid_t                   pid;
+
+    memset(&list, 0, sizeof(list));
+
+    if ((pid = ctest_runner_spawn(r, bin->path, "-l", NULL, 0, NULL, &list.fd)) < 0)
+        return CTEST_ERROR;
+
+    while ((n = ctest_runner_read(&list)) > 0);
+
+    close(list.fd);
+    waitpid(pid, &status, 0);
+    names = ctest_hash_create(r->pool, 1024, 0);
+
+    for(line = list.out; line && *line; line = next) {
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+
+        if (line[0] != ' ' || line[1] != ' ' || line[2] == '\0')
+            continue;
+
+        if (ctest_runner_is_skip(r, line + 2))
+            continue;
+
+        key = ctest_hash_code(line + 2, strlen(line + 2), 7);
+
+        if (ctest_hash_find(names, key) != NULL)
+            continue;
+
+        node = (ctest_hash_list_t *)ctest_pool_calloc(r->pool, sizeof(ctest_hash_list_t));
+        ctest_hash_add(names, key, node);
+
+        job = (ctest_runner_job_t *)ctest_pool_calloc(r->pool, sizeof(ctest_runner_job_t));
+        job->bin = bin;
+        job->name = ctest_pool_strdup(r->pool, line + 2);
+        job->fd = -1;
+        ctest_list_add_tail(&job->node, &r->queue);
+        bin->test_cnt ++;
+        r->total_cnt ++;
+    }
+
+    ctest_free(list.out);
+
+    // 127是exec失败
+    if (n < 0 || !WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "%s: can't list tests\n", bin->path);
+        return CTEST_ERROR;
+    }
+
+    return CTEST_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// result cache
+
+static void ctest_runner_hash_hex(const void *data, int len, char *hex)
+{
+    uint64_t                h[2];
+
+    h[0] = ctest_hash_code(data, len, 0x9e3779b9);
+    h[1] = ctest_hash_code(data, len, 0x85ebca6b);
+    ctest_string_tohex((const char *)h, sizeof(h), hex, CTEST_RUNNER_DIGEST_SIZE);
+}
+
+/**
+ * ELF里的NT_GNU_BUILD_ID, 没有的话用整个文件的hash; 返回是否动态链接
+ */
+static int ctest_runner_file_digest(const char *path, char *hex, int *dynamic)
+{
+    struct stat             st;
+    Elf64_Ehdr              *eh;
+    Elf64_Phdr              *ph;
+    Elf64_Nhdr              *nh;
+    char                    *m, *p, *end;
+    int                     fd, i, found = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return CTEST_ERROR;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0
+            || (m = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return CTEST_ERROR;
+    }
+
+    close(fd);
+    eh = (Elf64_Ehdr *)m;
+    *dynamic = 0;
+
+    if (st.st_size >= (off_t)sizeof(Elf64_Ehdr) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0
+            && eh->e_ident[EI_CLASS] == ELFCLASS64
+            && eh->e_phoff + eh->e_phnum * sizeof(Elf64_Phdr) <= (uint64_t)st.st_size) {
+        for(i = 0; i < eh->e_phnum; i++) {
+            ph = (Elf64_Phdr *)(m + eh->e_phoff) + i;
+
+            if (ph->p_type == PT_INTERP)
+                *dynamic = 1;
+
+            if (ph->p_type != PT_NOTE || found || ph->p_offset + ph->p_filesz > (uint64_t)st.st_size)
+                continue;
+
+            for(p = m + ph->p_offset, end = p + ph->p_filesz; p + sizeof(Elf64_Nhdr) <= end; ) {
+                nh = (Elf64_Nhdr *)p;
+                p += sizeof(Elf64_Nhdr) + ctest_align(nh->n_namesz, 4);
+
+                if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && memcmp(nh + 1, "GNU", 4) == 0
+                        && p + nh->n_descsz <= end) {
+                    ctest_runner_hash_hex(p, nh->n_descsz, hex);
+                    found = 1;
+                    break;
+                }
+
+                p += ctest_align(nh->n_descsz, 4);
+            }
+        }
+    }
+
+    if (found == 0)
+        ctest_runner_hash_hex(m, st.st_size, hex);
+
+    munmap(m, st.st_size);
+    return CTEST_OK;
+}
+
+/**
+ * 往manifest里追加一行"tag:path:digest"
+ */
+static void ctest_runner_manifest_file(ctest_buf_t *b, ctest_pool_t *pool, const char *tag, const char *path)
+{
+    char                    hex[CTEST_RUNNER_DIGEST_SIZE];
+    int                     dynamic, len;
+
+    if (ctest_runner_file_digest(path, hex, &dynamic) != CTEST_OK)
+        hex[0] = '\0';
+
+    len = strlen(tag) + strlen(path) + CTEST_RUNNER_DIGEST_SIZE + 3;
+
+    if (ctest_buf_check_read_space(pool, b, len) == CTEST_OK)
+        b->last += lnprintf(b->last, len, "%s:%s:%s\n", tag, path, hex);
+}
+
+/**
+ * bin的digest: build-id + LD_TRACE_LOADED_OBJECTS列出的so + 环境变量 + 参数
+ */
+static int ctest_runner_bin_digest(ctest_runner_t *r, ctest_runner_bin_t *bin)
+{
+    ctest_runner_job_t       ldd;
+    ctest_pool_t             *pool;
+    ctest_buf_t              *b;
+    char                    *line, *next, *path, *v;
+    int                     i, dynamic, len, status;
+    pid_t                   pid;
+
+    if (ctest_runner_file_digest(bin->path, bin->digest, &dynamic) != CTEST_OK)
+        return CTEST_ERROR;
+
+    pool = ctest_pool_create(4096);
+    b = ctest_buf_create(pool, 4096);
+    ctest_runner_manifest_file(b, pool, "bin", bin->path);
+
+    // 静态链接的程序设置LD_TRACE_LOADED_OBJECTS会直接运行
+    if (dynamic) {
+        memset(&ldd, 0, sizeof(ldd));
+
+        if ((pid = ctest_runner_spawn(r, bin->path, NULL, NULL, 0,
+                                     (char *)"LD_TRACE_LOADED_OBJECTS=1", &ldd.fd)) > 0) {
+            while (ctest_runner_read(&ldd) > 0);
+
+            close(ldd.fd);
+            waitpid(pid, &status, 0);
+        }
+
+        for(line = ldd.out; line && *line; line = next) {
+            if ((next = strchr(line, '\n')) != NULL)
+                *next++ = '\0';
+
+            if ((path = strstr(line, "=> ")) != NULL)
+                path += 3;
+            else if ((path = strchr(line, '/')) == NULL)
+                continue;
+
+            if ((v = strstr(path, " (")) != NULL)
+                *v = '\0';
+
+            if (*path == '/')
+                ctest_runner_manifest_file(b, pool, "so", path);
+        }
+
+        ctest_free(ldd.out);
+    }
+
+    for(i = 0; i < r->cache_env_cnt; i++) {
+        v = getenv(r->cache_env[i]);
+        len = strlen(r->cache_env[i]) + (v ? strlen(v) : 0) + 8;
+
+        if (ctest_buf_check_read_space(pool, b, len) == CTEST_OK)
+            b->last += lnprintf(b->last, len, "env:%s=%s\n", r->cache_env[i], (v ? v : ""));
+    }
+
+    // 参数里出现的文件也算进来, 比如--load的so
+    for(i = 0; i < r->arg_cnt; i++) {
+        v = strchr(r->args[i], '=');
+        ctest_runner_manifest_file(b, pool, "arg", (v ? v + 1 : r->args[i]));
+        len = strlen(r->args[i]) + 8;
+
+        if (ctest_buf_check_read_space(pool, b, len) == CTEST_OK)
+            b->last += lnprintf(b->last, len, "argv:%s\n", r->args[i]);
+    }
+
+    ctest_runner_hash_hex(b->pos, b->last - b->pos, bin->digest);
+    ctest_pool_destroy(pool);
+    return CTEST_OK;
+}
+
+static void ctest_runner_cache_path(ctest_runner_t *r, ctest_runner_job_t *job, char *path, int size)
+{
+    char                    buffer[1024], hex[CTEST_RUNNER_DIGEST_SIZE];
+    int                     len;
+
+    len = lnprintf(buffer, sizeof(buffer), "%s\n%s", job->bin->digest, job->name);
+    ctest_runner_hash_hex(buffer, len, hex);
+    lnprintf(path, size, "%s/%s", r->cache_dir, hex);
+}
+
+/**
+ * 命中cache的测试从队列里拿掉
+ */
+static int ctest_runner_cache_check(ctest_runner_t *r)
+{
+    ctest_runner_bin_t       *bin;
+    ctest_runner_job_t       *job, *n;
+    char                    path[1024];
+
+    if (mkdir(r->cache_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", r->cache_dir, strerror(errno));
+        return CTEST_ERROR;
+    }
+
+    ctest_list_for_each_entry(bin, &r->bin_list, node) {
+        if (ctest_runner_bin_digest(r, bin) != CTEST_OK) {
+            fprintf(stderr, "%s: can't read binary\n", bin->path);
+            return CTEST_ERROR;
+        }
+    }
+
+    ctest_list_for_each_entry_safe(job, n, &r->queue, node) {
+        ctest_runner_cache_path(r, job, path, sizeof(path));
+
+        if (access(path, F_OK) != 0)
+            continue;
+
+        ctest_runner_color_printf(CTEST_RUNNER_COLOR_GREEN, "[  CACHED  ]");
+        printf(" %s %s\n", job->bin->path, job->name);
+        job->cached = 1;
+        r->cached_cnt ++;
+        ctest_list_del(&job->node);
+        ctest_list_add_tail(&job->node, &r->done);
+    }
+
+    return CTEST_OK;
+}
+
+static void ctest_runner_cache_store(ctest_runner_t *r, ctest_runner_job_t *job)
+{
+    char                    path[1024];
+    int                     fd;
+
+    ctest_runner_cache_path(r, job, path, sizeof(path));
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+        ctest_ignore(write(fd, job->name, strlen(job->name)));
+        close(fd);
+    }
+}
+
+static void ctest_runner_finish(ctest_runner_t *r, ctest_runner_job_t *job)
+{
+    close(job->fd);
+    job->fd = -1;
+
+    while (waitpid(job->pid, &job->status, 0) < 0 && errno == EINTR);
+
+    r->slots[job->slot] = NULL;
+    r->running --;
+
+    // 输出整块打印, 不和其他slot交错
+    printf("%s:\n", job->bin->path);
+
+    if (job->out_len > 0) fwrite(job->out, 1, job->out_len, stdout);
+
+    if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0) {
+        job->status = 0;
+
+        if (r->cache_dir) ctest_runner_cache_store(r, job);
+    } else {
+        if (WIFSIGNALED(job->status))
+            printf("%s killed by signal %d\n", job->name, WTERMSIG(job->status));
+
+        job->status = 1;
+        r->failed_cnt ++;
+    }
+
+    printf("\n");
+    fflush(stdout);
+    ctest_free(job->out);
+    job->out = NULL;
+    job->out_len = job->out_size = 0;
+    ctest_list_add_tail(&job->node, &r->done);
+}
+
+static int ctest_runner_run(ctest_runner_t *r)
+{
+    ctest_runner_job_t       *job;
+    struct pollfd           pfds[CTEST_RUNNER_MAX_SLOT];
+    int                     i, n;
+
+    while (!ctest_list_empty(&r->queue) || r->running > 0) {
+        // 填满空闲的slot
+        for(i = 0; i < r->slot_cnt && !ctest_list_empty(&r->queue); i++) {
+            if (r->slots[i]) continue;
+
+            job = ctest_list_get_first(&r->queue, ctest_runner_job_t, node);
+            ctest_list_del(&job->node);
+            job->slot = i;
+            job->start = ctest_runner_now();
+
+            if (r->trace_file) {
+                job->trace_env = (char *)ctest_pool_alloc(r->pool, strlen(r->trace_file) + 32);
+                sprintf(job->trace_env, "%s=%s.%d", CTEST_TRACE_FILE_ENV, r->trace_file, r->trace_cnt++);
+            }
+
+            job->pid = ctest_runner_spawn(r, job->bin->path, "-f", job->name, i, job->trace_env, &job->fd);
+
+            if (job->pid < 0) {
+                fprintf(stderr, "%s: fork failed: %s\n", job->bin->path, strerror(errno));
+                return CTEST_ERROR;
+            }
+
+            r->slots[i] = job;
+            r->running ++;
+        }
+
+        for(i = n = 0; i < r->slot_cnt; i++) {
+            if (r->slots[i] == NULL) continue;
+
+            pfds[n].fd = r->slots[i]->fd;
+            pfds[n].events = POLLIN;
+            pfds[n].revents = 0;
+            n ++;
+        }
+
+        if (poll(pfds, n, -1) < 0 && errno != EINTR)
+            return CTEST_ERROR;
+
+        for(i = 0; i < r->slot_cnt; i++) {
+            if ((job = r->slots[i]) == NULL) continue;
+
+            for(n = 0; pfds[n].fd != job->fd; n++);
+
+            if (pfds[n].revents == 0) continue;
+
+            if (ctest_runner_read(job) <= 0)
+                ctest_runner_finish(r, job);
+        }
+    }
+
+    return CTEST_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// watch
+
+/**
+ * 上次的失败列表, 没有filter时只重跑这些
+ */
+static void ctest_runner_rerun_select(ctest_runner_t *r)
+{
+    ctest_runner_job_t       *job, *n;
+    ctest_hash_t             *failed;
+    ctest_hash_list_t        *node;
+    const char              *state;
+    char                    line[1024];
+    uint64_t                key;
+    int                     len;
+    FILE                    *fp;
+
+    if ((state = getenv(CTEST_RUNNER_STATE_ENV)) == NULL || (fp = fopen(state, "r")) == NULL)
+        return;
+
+    failed = ctest_hash_create(r->pool, 128, 0);
+
+    while (fgets(line, sizeof(line), fp)) {
+        len = strlen(line);
+
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+
+        node = (ctest_hash_list_t *)ctest_pool_calloc(r->pool, sizeof(ctest_hash_list_t));
+        ctest_hash_add(failed, ctest_hash_code(line, len, 7), node);
+    }
+
+    fclose(fp);
+
+    if (r->filter_str_len || failed->count == 0)
+        return;
+
+    ctest_list_for_each_entry_safe(job, n, &r->queue, node) {
+        len = lnprintf(line, sizeof(line), "%s\t%s", job->bin->path, job->name);
+        key = ctest_hash_code(line, len, 7);
+
+        if (ctest_hash_find(failed, key) == NULL) {
+            ctest_list_del(&job->node);
+            job->bin->test_cnt --;
+            r->total_cnt --;
+        }
+    }
+}
+
+/**
+ * 第一次用mkstemp建, 放在--cache-dir或者$XDG_RUNTIME_DIR下, 都没有才用/tmp;
+ * re-exec以后从环境变量拿到同一个文件, 打开时不跟符号链接
+ */
+static int ctest_runner_rerun_save(ctest_runner_t *r)
+{
+    ctest_runner_job_t       *job;
+    const char              *state, *dir;
+    char                    buffer[PATH_MAX];
+    int                     fd;
+    FILE                    *fp;
+
+    if ((state = getenv(CTEST_RUNNER_STATE_ENV)) == NULL) {
+        if ((dir = r->cache_dir) == NULL && (dir = getenv("XDG_RUNTIME_DIR")) == NULL)
+            dir = "/tmp";
+
+        lnprintf(buffer, sizeof(buffer), "%s/ctest-runner.XXXXXX", dir);
+
+        if ((fd = mkstemp(buffer)) < 0) {
+            fprintf(stderr, "%s: %s\n", buffer, strerror(errno));
+            return CTEST_ERROR;
+        }
+
+        setenv(CTEST_RUNNER_STATE_ENV, buffer, 1);
+    } else if ((fd = open(state, O_WRONLY | O_TRUNC | O_NOFOLLOW)) < 0) {
+        fprintf(stderr, "%s: %s\n", state, strerror(errno));
+        return CTEST_ERROR;
+    }
+
+    if ((fp = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        return CTEST_ERROR;
+    }
+
+    ctest_list_for_each_entry(job, &r->done, node) {
+        if (job->status) fprintf(fp, "%s\t%s\n", job->bin->path, job->name);
+    }
+
+    fclose(fp);
+    return CTEST_OK;
+}
+
+/**
+ * 文件盯的是所在目录, 链接器常常是删掉再重建
+ * mode[wd]: 1 只关心测试程序和runner自己, 2 目录里任何变化
+ */
+static int ctest_runner_watch_add(int ifd, const char *path, int is_dir, int *mode)
+{
+    char                    dir[PATH_MAX], *p;
+    int                     wd;
+
+    ctest_strncpy(dir, path, sizeof(dir));
+
+    if (is_dir == 0) {
+        if ((p = strrchr(dir, '/')) == NULL)
+            strcpy(dir, ".");
+        else if (p == dir)
+            p[1] = '\0';
+        else
+            *p = '\0';
+    }
+
+    if ((wd = inotify_add_watch(ifd, dir, CTEST_RUNNER_WATCH_MASK)) < 0
+            || wd >= CTEST_RUNNER_MAX_WATCH * 2) {
+        fprintf(stderr, "watch %s: %s\n", dir, strerror(errno));
+        return CTEST_ERROR;
+    }
+
+    mode[wd] = ctest_max(mode[wd], (is_dir ? 2 : 1));
+    return CTEST_OK;
+}
+
+static int ctest_runner_watch_match(ctest_runner_t *r, struct inotify_event *ev, int *mode, const char *self)
+{
+    ctest_runner_bin_t       *bin;
+    const char              *p;
+
+    if (ev->wd < 0 || ev->wd >= CTEST_RUNNER_MAX_WATCH * 2 || mode[ev->wd] == 0)
+        return 0;
+
+    if (mode[ev->wd] == 2)
+        return 1;
+
+    if (ev->len == 0)
+        return 0;
+
+    ctest_list_for_each_entry(bin, &r->bin_list, node) {
+        p = strrchr(bin->path, '/');
+
+        if (strcmp(p ? p + 1 : bin->path, ev->name) == 0)
+            return 1;
+    }
+
+    p = strrchr(self, '/');
+    return (strcmp(p ? p + 1 : self, ev->name) == 0);
+}
+
+/**
+ * 等到有变化(安静300ms以后), 然后re-exec自己
+ */
+static int ctest_runner_watch(ctest_runner_t *r, char *argv[])
+{
+    ctest_runner_bin_t       *bin;
+    struct inotify_event    *ev;
+    struct pollfd           pfd;
+    int                     mode[CTEST_RUNNER_MAX_WATCH * 2];
+    char                    buffer[8192], self[PATH_MAX], *p;
+    int                     ifd, i, n, changed;
+
+    if (ctest_runner_rerun_save(r) != CTEST_OK)
+        return CTEST_ERROR;
+
+    if ((n = readlink("/proc/self/exe", self, sizeof(self) - 1)) <= 0)
+        return CTEST_ERROR;
+
+    self[n] = '\0';
+
+    if ((ifd = inotify_init1(IN_CLOEXEC)) < 0)
+        return CTEST_ERROR;
+
+    memset(mode, 0, sizeof(mode));
+
+    if (ctest_runner_watch_add(ifd, self, 0, mode) != CTEST_OK)
+        return CTEST_ERROR;
+
+    ctest_list_for_each_entry(bin, &r->bin_list, node) {
+        if (ctest_runner_watch_add(ifd, bin->path, 0, mode) != CTEST_OK)
+            return CTEST_ERROR;
+    }
+
+    for(i = 0; i < r->watch_path_cnt; i++) {
+        if (ctest_runner_watch_add(ifd, r->watch_path[i], 1, mode) != CTEST_OK)
+            return CTEST_ERROR;
+    }
+
+    printf("watching for changes, ctrl-c to stop\n");
+    fflush(stdout);
+
+    pfd.fd = ifd;
+    pfd.events = POLLIN;
+    changed = 0;
+
+    while ((n = poll(&pfd, 1, (changed ? 300 : -1))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+
+            return CTEST_ERROR;
+        }
+
+        if ((n = read(ifd, buffer, sizeof(buffer))) <= 0)
+            continue;
+
+        for(p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *)p;
+
+            if (ctest_runner_watch_match(r, ev, mode, self))
+                changed = 1;
+        }
+    }
+
+    close(ifd);
+    printf("\nchange detected, rerunning\n\n");
+    fflush(stdout);
+    execv(self, argv);
+    fprintf(stderr, "exec %s: %s\n", self, strerror(errno));
+    return CTEST_ERROR;
+}
+
+/**
+ * 把每个测试的trace合并起来
+ */
+static int ctest_runner_trace_merge(ctest_runner_t *r)
+{
+    ctest_runner_job_t       *job;
+    char                    **files;
+    int                     cnt = 0;
+
+    files = (char **)ctest_pool_calloc(r->pool, (r->trace_cnt + 1) * sizeof(char *));
+
+    ctest_list_for_each_entry(job, &r->done, node) {
+        if (job->trace_env) files[cnt++] = strchr(job->trace_env, '=') + 1;
+    }
+
+    return ctest_trace_merge(r->trace_file, files, cnt, r->slot_cnt);
+}
+
+static void ctest_runner_summary(ctest_runner_t *r, int64_t t)
+{
+    ctest_runner_job_t       *job;
+    ctest_runner_bin_t       *bin;
+    int                     bin_cnt = 0;
+
+    ctest_list_for_each_entry(bin, &r->bin_list, node) {
+        bin_cnt ++;
+    }
+
+    ctest_runner_color_printf(CTEST_RUNNER_COLOR_GREEN, "[==========]");
+    printf(" %d tests from %d binaries ran on %d slots. (%d ms total)\n",
+           r->total_cnt, bin_cnt, r->slot_cnt, (int)t);
+    ctest_runner_color_printf(CTEST_RUNNER_COLOR_GREEN, "[  PASSED  ]");
+    printf(" %d tests.\n", r->total_cnt - r->failed_cnt - r->cached_cnt);
+
+    if (r->cached_cnt > 0) {
+        ctest_runner_color_printf(CTEST_RUNNER_COLOR_GREEN, "[  CACHED  ]");
+        printf(" %d tests.\n", r->cached_cnt);
+    }
+
+    if (r->failed_cnt > 0) {
+        ctest_runner_color_printf(CTEST_RUNNER_COLOR_RED, "[  FAILED  ]");
+        printf(" %d tests, listed below:\n", r->failed_cnt);
+        ctest_list_for_each_entry(job, &r->done, node) {
+            if (!job->status) continue;
+
+            ctest_runner_color_printf(CTEST_RUNNER_COLOR_RED, "[  FAILED  ]");
+            printf(" %s %s\n", job->bin->path, job->name);
+        }
+        printf(" %d FAILED TEST\n", r->failed_cnt);
+    }
+}
+
+/**
+ * 发送参数, 每个以'\0'结束, 再加一个空参数; 输出原样打印, 最后两个字节是'\0'和退出码
+ */
+static int ctest_runner_connect(ctest_runner_t *r)
+{
+    struct sockaddr_un      addr;
+    ctest_buf_t              *b;
+    char                    buffer[8192];
+    int                     fd, i, n, hold, ret = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ctest_strncpy(addr.sun_path, r->connect_path, sizeof(addr.sun_path));
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "connect %s: %s\n", r->connect_path, strerror(errno));
+
+        if (fd >= 0) close(fd);
+
+        return 1;
+    }
+
+    b = ctest_buf_create(r->pool, 4096);
+
+    if (r->filter_arg) {
+        b->last = ctest_memcpy(b->last, "-f", 3);
+        b->last = ctest_memcpy(b->last, r->filter_arg, strlen(r->filter_arg) + 1);
+    }
+
+    for(i = 0; i < r->arg_cnt && b->end - b->last > (int)strlen(r->args[i]) + 2; i++)
+        b->last = ctest_memcpy(b->last, r->args[i], strlen(r->args[i]) + 1);
+
+    *b->last++ = '\0';
+
+    if (write(fd, b->pos, b->last - b->pos) != b->last - b->pos) {
+        fprintf(stderr, "write %s: %s\n", r->connect_path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    // 最后两个字节留着
+    for(hold = 0; (n = read(fd, buffer + hold, sizeof(buffer) - hold)) > 0; ) {
+        n += hold;
+        hold = ctest_min(n, 2);
+
+        if (n > hold && fwrite(buffer, 1, n - hold, stdout) != (size_t)(n - hold))
+            break;
+
+        memmove(buffer, buffer + n - hold, hold);
+        fflush(stdout);
+    }
+
+    if (hold == 2 && buffer[0] == '\0')
+        ret = (unsigned char)buffer[1];
+    else if (hold)
+        fwrite(buffer, 1, hold, stdout);
+
+    close(fd);
+    return ret;
+}
+
+static int ctest_runner_parse_cmd_line(ctest_runner_t *r, int argc, char *argv[])
+{
+    ctest_runner_bin_t       *bin;
+    int                     opt, i, len;
+    const char              *opt_string = "+hj:f:";
+    struct option           long_opts[] = {
+        {"jobs", 1, NULL, 'j'},
+        {"filter", 1, NULL, 'f'},
+        {"cache-dir", 1, NULL, 'C'},
+        {"cache-env", 1, NULL, 'E'},
+        {"watch", 0, NULL, 'W'},
+        {"watch-path", 1, NULL, 'w'},
+        {"connect", 1, NULL, 'S'},
+        {"trace", 1, NULL, 'T'},
+        {"help", 0, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    opterr = 0;
+
+    while ((opt = getopt_long(argc, argv, opt_string, long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'j':
+            r->slot_cnt = atoi(optarg);
+            break;
+
+        case 'f':
+            r->filter_arg = optarg;
+            r->filter_flags = (*optarg == '-');
+            r->filter_str = optarg + r->filter_flags;
+            len = strlen(r->filter_str);
+
+            if (len > 0 && (r->filter_str[len - 1] == '*' || r->filter_str[len - 1] == '?'))
+                r->filter_str_len = len - 1;
+            else
+                r->filter_str_len = -1;
+
+            break;
+
+        case 'C':
+            r->cache_dir = optarg;
+            break;
+
+        case 'E':
+            if (r->cache_env_cnt < CTEST_RUNNER_MAX_ENV)
+                r->cache_env[r->cache_env_cnt++] = optarg;
+
+            break;
+
+        case 'W':
+            r->watch = 1;
+            break;
+
+        case 'w':
+            if (r->watch_path_cnt < CTEST_RUNNER_MAX_WATCH)
+                r->watch_path[r->watch_path_cnt++] = optarg;
+
+            break;
+
+        case 'S':
+            r->connect_path = optarg;
+            break;
+
+        case 'T':
+            r->trace_file = optarg;
+            break;
+
+        case 'h':
+        default:
+            ctest_runner_print_usage(argv[0]);
+            return CTEST_ERROR;
+        }
+    }
+
+    // --connect没有binary, 剩下的都是参数
+    if (r->connect_path) {
+        r->args = argv + optind;
+        r->arg_cnt = argc - optind;
+        return CTEST_OK;
+    }
+
+    for(i = optind; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            r->args = argv + i + 1;
+            r->arg_cnt = argc - i - 1;
+            break;
+        }
+
+        bin = (ctest_runner_bin_t *)ctest_pool_calloc(r->pool, sizeof(ctest_runner_bin_t));
+        bin->path = argv[i];
+        ctest_list_add_tail(&bin->node, &r->bin_list);
+    }
+
+    // 参数里的--trace由runner接管, 不然每个测试进程都写同一个文件
+    for(i = len = 0; i < r->arg_cnt; i++) {
+        if (strncmp(r->args[i], "--trace=", 8) == 0)
+            r->trace_file = r->args[i] + 8;
+        else
+            r->args[len++] = r->args[i];
+    }
+
+    r->arg_cnt = len;
+
+    if (ctest_list_empty(&r->bin_list)) {
+        ctest_runner_print_usage(argv[0]);
+        return CTEST_ERROR;
+    }
+
+    if (r->slot_cnt <= 0)
+        r->slot_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+
+    r->slot_cnt = ctest_max(1, ctest_min(r->slot_cnt, CTEST_RUNNER_MAX_SLOT));
+    return CTEST_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    ctest_runner_t           r;
+    ctest_runner_bin_t       *bin;
+    char                    buffer[32];
+    int64_t                 t1;
+    int                     ret = 1;
+
+    memset(&r, 0, sizeof(r));
+    r.pool = ctest_pool_create(4096);
+    ctest_list_init(&r.bin_list);
+    ctest_list_init(&r.queue);
+    ctest_list_init(&r.done);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (ctest_runner_parse_cmd_line(&r, argc, argv) != CTEST_OK)
+        goto out;
+
+    if (r.connect_path) {
+        ret = ctest_runner_connect(&r);
+        goto out;
+    }
+
+    ctest_list_for_each_entry(bin, &r.bin_list, node) {
+        if (ctest_runner_list(&r, bin) != CTEST_OK)
+            goto out;
+    }
+
+    if (r.watch) ctest_runner_rerun_select(&r);
+
+    ctest_runner_color_printf(CTEST_RUNNER_COLOR_GREEN, "[==========]");
+    printf(" Running %d tests on %d slots.\n\n", r.total_cnt, r.slot_cnt);
+    fflush(stdout);
+
+    t1 = ctest_runner_now();
+
+    if (r.cache_dir && ctest_runner_cache_check(&r) != CTEST_OK)
+        goto out;
+
+    if (r.trace_file) {
+        lnprintf(buffer, sizeof(buffer), "%d", (int)getpid());
+        setenv(CTEST_TRACE_PID_ENV, buffer, 1);
+    }
+
+    if (ctest_runner_run(&r) != CTEST_OK)
+        goto out;
+
+    if (r.trace_file && ctest_runner_trace_merge(&r) != CTEST_OK)
+        fprintf(stderr, "trace: can't write %s\n", r.trace_file);
+
+    ctest_runner_summary(&r, ctest_runner_now() - t1);
+    ret = (r.failed_cnt > 0 ? 1 : 0);
+
+    if (r.watch) ctest_runner_watch(&r, argv);
+
+out:
+    ctest_pool_destroy(r.pool);
+    return ret;
+}
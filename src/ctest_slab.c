@@ -0,0 +1,379 @@
+#include "ctest_slab.h"
+#include "ctest_string.h"
+
+/**
+ * 对象前面16字节的头记录级别, free时O(1)找到free list, 用户区和malloc一样16字节对齐;
+ * 空闲对象的next指针存在用户区的开头.
+ * 大的直接从pool分, 是pool的large时free还回去, 在block里的等pool clear
+ */
+
+#define CTEST_SLAB_MAGIC             0x42414c53
+#define CTEST_SLAB_MAGIC_FREE        0x45455246
+#define CTEST_SLAB_LARGE             0xffffffff
+#define CTEST_SLAB_POOL              0xfffffffe
+
+typedef struct ctest_slab_obj_t {
+    uint32_t                cls;
+    uint32_t                magic;
+    uint64_t                reserved;
+} ctest_slab_obj_t;
+
+static void ctest_slab_init_classes(ctest_slab_t *slab);
+static ctest_slab_cache_t *ctest_slab_get_cache(ctest_slab_t *slab);
+static void ctest_slab_cache_release(void *data);
+static int ctest_slab_class_get(ctest_slab_t *slab, ctest_slab_class_t *c, void **head, int cnt);
+static void ctest_slab_class_put(ctest_slab_class_t *c, void *head, void *tail, int cnt);
+static void ctest_slab_cleanup(const void *data);
+
+/**
+ * 有线程cache时在pool上注册cleanup, pool clear/destroy之前先ctest_slab_destroy,
+ * 之后退出的线程不会再碰到slab
+ */
+ctest_slab_t *ctest_slab_create(ctest_pool_t *pool, int flags)
+{
+    ctest_slab_t             *slab;
+    ctest_pool_cleanup_t     *cl;
+
+    if ((slab = (ctest_slab_t *)ctest_pool_calloc(pool, sizeof(ctest_slab_t))) == NULL)
+        return NULL;
+
+    slab->pool = pool;
+    slab->flags = (flags & ~CTEST_SLAB_THREAD_CACHE);
+    ctest_list_init(&slab->caches);
+    ctest_slab_init_classes(slab);
+
+    if ((flags & CTEST_SLAB_THREAD_CACHE) == 0)
+        return slab;
+
+    if ((cl = ctest_pool_cleanup_new(pool, slab, ctest_slab_cleanup)) == NULL
+            || pthread_key_create(&slab->key, ctest_slab_cache_release) != 0)
+        return NULL;
+
+    slab->flags |= CTEST_SLAB_THREAD_CACHE;
+    ctest_pool_cleanup_reg(pool, cl);
+    return slab;
+}
+
+/**
+ * 删掉线程cache的key并释放所有cache, 页和slab本身在pool上.
+ * 调用时别的线程不能再用这个slab; 之后退出的线程不会再跑cache的析构.
+ * 可以调用多次, pool clear/destroy时会自动调用
+ */
+void ctest_slab_destroy(ctest_slab_t *slab)
+{
+    ctest_slab_cache_t       *cache, *n;
+
+    if ((slab->flags & CTEST_SLAB_THREAD_CACHE) == 0)
+        return;
+
+    slab->flags &= ~CTEST_SLAB_THREAD_CACHE;
+    pthread_key_delete(slab->key);
+    ctest_spin_lock(&slab->lock);
+
+    ctest_list_for_each_entry_safe(cache, n, &slab->caches, node) {
+        ctest_list_del(&cache->node);
+        ctest_free(cache);
+    }
+
+    ctest_spin_unlock(&slab->lock);
+}
+
+void *ctest_slab_alloc(ctest_slab_t *slab, uint32_t size)
+{
+    ctest_slab_obj_t         *obj;
+    ctest_slab_cache_t       *cache;
+    ctest_slab_class_t       *c;
+    void                    *head;
+    int                     i;
+
+    // 大的直接从pool拿
+    if (size > CTEST_SLAB_MAX_SIZE - sizeof(ctest_slab_obj_t)) {
+        if (size > UINT32_MAX - sizeof(ctest_slab_obj_t)
+                || (obj = (ctest_slab_obj_t *)ctest_pool_alloc_ex(slab->pool, size + sizeof(ctest_slab_obj_t), 16)) == NULL)
+            return NULL;
+
+        obj->cls = (ctest_pool_large_base(slab->pool, obj) ? CTEST_SLAB_LARGE : CTEST_SLAB_POOL);
+        obj->magic = CTEST_SLAB_MAGIC;
+        ctest_atomic_inc((ctest_atomic_t *)&slab->large_alloc);
+        return obj + 1;
+    }
+
+    // 空闲时用户区要放得下next指针
+    i = slab->index[(ctest_max(size, (uint32_t)sizeof(void *)) + sizeof(ctest_slab_obj_t) + 15) >> 4];
+    c = &slab->classes[i];
+
+    if ((slab->flags & CTEST_SLAB_THREAD_CACHE) && (cache = ctest_slab_get_cache(slab)) != NULL) {
+        if (cache->classes[i].head == NULL) {
+            cache->classes[i].cnt = ctest_slab_class_get(slab, c, &cache->classes[i].head, CTEST_SLAB_CACHE_BATCH);
+
+            if (cache->classes[i].cnt == 0)
+                return NULL;
+        }
+
+        head = cache->classes[i].head;
+        cache->classes[i].head = *((void **)head);
+        cache->classes[i].cnt --;
+        cache->classes[i].nalloc ++;
+    } else {
+        if (ctest_slab_class_get(slab, c, &head, 1) == 0)
+            return NULL;
+
+        ctest_spin_lock(&c->lock);
+        c->nalloc ++;
+        ctest_spin_unlock(&c->lock);
+    }
+
+    obj = ((ctest_slab_obj_t *)head) - 1;
+    assert(obj->magic != CTEST_SLAB_MAGIC);
+    obj->magic = CTEST_SLAB_MAGIC;
+    return head;
+}
+
+void ctest_slab_free(ctest_slab_t *slab, void *ptr)
+{
+    ctest_slab_obj_t         *obj;
+    ctest_slab_cache_t       *cache;
+    ctest_slab_class_t       *c;
+    void                    *head, *tail;
+    int                     i, cnt;
+
+    if (ptr == NULL)
+        return;
+
+    obj = ((ctest_slab_obj_t *)ptr) - 1;
+    assert(obj->magic == CTEST_SLAB_MAGIC);
+
+    if (obj->cls == CTEST_SLAB_LARGE || obj->cls == CTEST_SLAB_POOL) {
+        ctest_atomic_inc((ctest_atomic_t *)&slab->large_free);
+        obj->magic = CTEST_SLAB_MAGIC_FREE;
+
+        if (obj->cls == CTEST_SLAB_LARGE)
+            ctest_pool_free_large(slab->pool, obj);
+
+        return;
+    }
+
+    obj->magic = CTEST_SLAB_MAGIC_FREE;
+    c = &slab->classes[obj->cls];
+
+    if ((slab->flags & CTEST_SLAB_THREAD_CACHE) && (cache = ctest_slab_get_cache(slab)) != NULL) {
+        i = obj->cls;
+        *((void **)ptr) = cache->classes[i].head;
+        cache->classes[i].head = ptr;
+        cache->classes[i].nfree ++;
+
+        if (++ cache->classes[i].cnt < CTEST_SLAB_CACHE_MAX)
+            return;
+
+        // 还一半回去
+        head = tail = cache->classes[i].head;
+
+        for(cnt = 1; cnt < CTEST_SLAB_CACHE_MAX / 2; cnt++)
+            tail = *((void **)tail);
+
+        cache->classes[i].head = *((void **)tail);
+        cache->classes[i].cnt -= cnt;
+        ctest_slab_class_put(c, head, tail, 0);
+    } else {
+        ctest_slab_class_put(c, ptr, ptr, 1);
+    }
+}
+
+/**
+ * 每级的统计, 返回级别数
+ */
+int ctest_slab_stats(ctest_slab_t *slab, ctest_slab_stat_t *st, int n)
+{
+    ctest_slab_cache_t       *cache;
+    ctest_slab_class_t       *c;
+    int                     i;
+
+    n = ctest_min(n, CTEST_SLAB_CLASSES);
+
+    for(i = 0; i < n; i++) {
+        c = &slab->classes[i];
+        ctest_spin_lock(&c->lock);
+        st[i].size = c->size;
+        st[i].pages = c->pages;
+        st[i].objects = c->pages * (CTEST_SLAB_PAGE_SIZE / c->size);
+        st[i].nalloc = c->nalloc;
+        st[i].nfree = c->nfree;
+        ctest_spin_unlock(&c->lock);
+    }
+
+    // 线程cache上的计数不加锁, 只是近似值
+    ctest_spin_lock(&slab->lock);
+
+    ctest_list_for_each_entry(cache, &slab->caches, node) {
+        for(i = 0; i < n; i++) {
+            st[i].nalloc += cache->classes[i].nalloc;
+            st[i].nfree += cache->classes[i].nfree;
+        }
+    }
+
+    ctest_spin_unlock(&slab->lock);
+
+    for(i = 0; i < n; i++)
+        st[i].inuse = st[i].nalloc - st[i].nfree;
+
+    return n;
+}
+
+void ctest_slab_print_stats(ctest_slab_t *slab, FILE *fp)
+{
+    ctest_slab_stat_t        st[CTEST_SLAB_CLASSES];
+    char                    buffer[32];
+    int                     i, n;
+
+    n = ctest_slab_stats(slab, st, CTEST_SLAB_CLASSES);
+    fprintf(fp, "%6s %8s %10s %10s %12s %12s\n", "size", "mem", "objects", "inuse", "alloc", "free");
+
+    for(i = 0; i < n; i++) {
+        if (st[i].pages == 0)
+            continue;
+
+        fprintf(fp, "%6u %8s %10" PRId64 " %10" PRId64 " %12" PRId64 " %12" PRId64 "\n", st[i].size,
+                ctest_string_format_size(st[i].pages * CTEST_SLAB_PAGE_SIZE, buffer, sizeof(buffer)),
+                st[i].objects, st[i].inuse, st[i].nalloc, st[i].nfree);
+    }
+
+    if (slab->large_alloc)
+        fprintf(fp, "%6s %8s %10s %10" PRId64 " %12" PRId64 " %12" PRId64 "\n", "large", "-", "-",
+                slab->large_alloc - slab->large_free, slab->large_alloc, slab->large_free);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// 16到128每16字节一级, 之后每个2的幂分4级, 到4096
+static void ctest_slab_init_classes(ctest_slab_t *slab)
+{
+    uint32_t                size, p;
+    int                     i, j;
+
+    for(i = 0, size = 16; size <= 128; size += 16)
+        slab->classes[i++].size = size;
+
+    for(p = 128; p < CTEST_SLAB_MAX_SIZE; p <<= 1) {
+        for(j = 1; j <= 4; j++)
+            slab->classes[i++].size = p + p / 4 * j;
+    }
+
+    assert(i == CTEST_SLAB_CLASSES);
+
+    for(i = 0, j = 0; j <= CTEST_SLAB_MAX_SIZE / 16; j++) {
+        if ((uint32_t)j * 16 > slab->classes[i].size) i++;
+
+        slab->index[j] = i;
+    }
+}
+
+static void ctest_slab_cleanup(const void *data)
+{
+    ctest_slab_destroy((ctest_slab_t *)data);
+}
+
+static ctest_slab_cache_t *ctest_slab_get_cache(ctest_slab_t *slab)
+{
+    ctest_slab_cache_t       *cache;
+
+    if ((cache = (ctest_slab_cache_t *)pthread_getspecific(slab->key)) != NULL)
+        return cache;
+
+    if ((cache = (ctest_slab_cache_t *)ctest_malloc(sizeof(ctest_slab_cache_t))) == NULL)
+        return NULL;
+
+    memset(cache, 0, sizeof(ctest_slab_cache_t));
+    cache->slab = slab;
+    ctest_spin_lock(&slab->lock);
+    ctest_list_add_tail(&cache->node, &slab->caches);
+    ctest_spin_unlock(&slab->lock);
+    pthread_setspecific(slab->key, cache);
+    return cache;
+}
+
+// 线程退出, 把cache里的对象还回去
+static void ctest_slab_cache_release(void *data)
+{
+    ctest_slab_cache_t       *cache = (ctest_slab_cache_t *)data;
+    ctest_slab_t             *slab = cache->slab;
+    ctest_slab_class_t       *c;
+    void                    *tail;
+    int                     i;
+
+    for(i = 0; i < CTEST_SLAB_CLASSES; i++) {
+        c = &slab->classes[i];
+
+        if (cache->classes[i].head) {
+            for(tail = cache->classes[i].head; *((void **)tail); tail = *((void **)tail));
+
+            ctest_slab_class_put(c, cache->classes[i].head, tail, 0);
+        }
+
+        ctest_spin_lock(&c->lock);
+        c->nalloc += cache->classes[i].nalloc;
+        c->nfree += cache->classes[i].nfree;
+        ctest_spin_unlock(&c->lock);
+    }
+
+    ctest_spin_lock(&slab->lock);
+    ctest_list_del(&cache->node);
+    ctest_spin_unlock(&slab->lock);
+    ctest_free(cache);
+}
+
+/**
+ * 取cnt个对象串成链表, 先取free list, 再从页上切, 返回取到的个数
+ */
+static int ctest_slab_class_get(ctest_slab_t *slab, ctest_slab_class_t *c, void **head, int cnt)
+{
+    ctest_slab_obj_t         *obj;
+    uint8_t                 *m;
+    void                    *list, **tail;
+    int                     n;
+
+    list = NULL;
+    tail = &list;
+    ctest_spin_lock(&c->lock);
+
+    for(n = 0; n < cnt; n++) {
+        if (c->free) {
+            *tail = c->free;
+            c->free = *((void **)c->free);
+        } else {
+            if (c->last + c->size > c->end) {
+                ctest_spin_lock(&slab->lock);
+                m = (uint8_t *)ctest_pool_alloc_ex(slab->pool, CTEST_SLAB_PAGE_SIZE, 16);
+                ctest_spin_unlock(&slab->lock);
+
+                if (m == NULL)
+                    break;
+
+                c->last = m;
+                c->end = m + CTEST_SLAB_PAGE_SIZE;
+                c->pages ++;
+            }
+
+            obj = (ctest_slab_obj_t *)c->last;
+            obj->cls = (uint32_t)(c - slab->classes);
+            obj->magic = CTEST_SLAB_MAGIC_FREE;
+            c->last += c->size;
+            *tail = obj + 1;
+        }
+
+        tail = (void **)*tail;
+    }
+
+    *tail = NULL;
+    ctest_spin_unlock(&c->lock);
+    *head = list;
+    return n;
+}
+
+// cnt是non-cache路径上的free计数
+static void ctest_slab_class_put(ctest_slab_class_t *c, void *head, void *tail, int cnt)
+{
+    ctest_spin_lock(&c->lock);
+    *((void **)tail) = c->free;
+    c->free = head;
+    c->nfree += cnt;
+    ctest_spin_unlock(&c->lock);
+}
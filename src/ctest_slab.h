@@ -0,0 +1,81 @@
+#ifndef CTEST_SLAB_H_
+#define CTEST_SLAB_H_
+
+/**
+ * 按大小分级的slab, 页从ctest_pool_t里取, 每级一个free list, 可以单个释放.
+ * 页只在ctest_pool_clear/destroy时还回去, 返回的内存16字节对齐.
+ * CTEST_SLAB_THREAD_CACHE: pool clear/destroy时线程cache跟着释放, 这之前
+ * 用过slab的线程要停止使用它
+ */
+#include "ctest_pool.h"
+#include "ctest_list.h"
+#include <pthread.h>
+
+CTEST_CPP_START
+
+#define CTEST_SLAB_PAGE_SIZE         65536
+#define CTEST_SLAB_MAX_SIZE          4096
+#define CTEST_SLAB_CLASSES           28
+#define CTEST_SLAB_THREAD_CACHE      0x01
+#define CTEST_SLAB_CACHE_BATCH       16
+#define CTEST_SLAB_CACHE_MAX         64
+
+typedef struct ctest_slab_t ctest_slab_t;
+typedef struct ctest_slab_class_t ctest_slab_class_t;
+typedef struct ctest_slab_cache_t ctest_slab_cache_t;
+typedef struct ctest_slab_stat_t ctest_slab_stat_t;
+
+struct ctest_slab_class_t {
+    uint32_t                size;
+    ctest_atomic_t           lock;
+    void                    *free;
+    uint8_t                 *last;
+    uint8_t                 *end;
+    int64_t                 pages;
+    int64_t                 nalloc;
+    int64_t                 nfree;
+};
+
+struct ctest_slab_t {
+    ctest_pool_t             *pool;
+    int                     flags;
+    pthread_key_t           key;
+    ctest_atomic_t           lock;
+    ctest_list_t             caches;
+    int64_t                 large_alloc;
+    int64_t                 large_free;
+    uint8_t                 index[CTEST_SLAB_MAX_SIZE / 16 + 1];
+    ctest_slab_class_t       classes[CTEST_SLAB_CLASSES];
+};
+
+// 每个线程一份, 分配和释放先走这里
+struct ctest_slab_cache_t {
+    ctest_slab_t             *slab;
+    ctest_list_t             node;
+    struct {
+        void                *head;
+        int                 cnt;
+        int64_t             nalloc;
+        int64_t             nfree;
+    } classes[CTEST_SLAB_CLASSES];
+};
+
+struct ctest_slab_stat_t {
+    uint32_t                size;
+    int64_t                 pages;
+    int64_t                 objects;
+    int64_t                 inuse;
+    int64_t                 nalloc;
+    int64_t                 nfree;
+};
+
+extern ctest_slab_t *ctest_slab_create(ctest_pool_t *pool, int flags);
+extern void ctest_slab_destroy(ctest_slab_t *slab);
+extern void *ctest_slab_alloc(ctest_slab_t *slab, uint32_t size);
+extern void ctest_slab_free(ctest_slab_t *slab, void *ptr);
+extern int ctest_slab_stats(ctest_slab_t *slab, ctest_slab_stat_t *st, int n);
+extern void ctest_slab_print_stats(ctest_slab_t *slab, FILE *fp);
+
+CTEST_CPP_END
+
+#endif
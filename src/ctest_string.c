@@ -1,4 +1,7 @@
 #include <ctest_string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static char *ctest_sprintf_num(char *buf, char *last, uint64_t ui64, char zero, int hexadecimal, int width, int sign);
 static char *ctest_fill_space(int width, char *buf, char *fstart, char *last);
@@ -116,6 +119,66 @@ char *ctest_string_tohex(const char *str, int n, char *result, int size)
     return result;
 }
 
+/**
+ * 找第一个不相同的字节, 相同返回-1; 有SSE2时每次比64字节
+ */
+int64_t ctest_string_mismatch(const void *a, const void *b, size_t len)
+{
+    const unsigned char     *pa = (const unsigned char *)a;
+    const unsigned char     *pb = (const unsigned char *)b;
+    size_t                  i = 0;
+    uint64_t                wa, wb;
+
+#ifdef __SSE2__
+    __m128i                 m0, m1, m2, m3;
+    int                     mask;
+
+    for(; i + 64 <= len; i += 64) {
+        m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i)),
+                            _mm_loadu_si128((const __m128i *)(pb + i)));
+        m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i + 16)),
+                            _mm_loadu_si128((const __m128i *)(pb + i + 16)));
+        m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i + 32)),
+                            _mm_loadu_si128((const __m128i *)(pb + i + 32)));
+        m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i + 48)),
+                            _mm_loadu_si128((const __m128i *)(pb + i + 48)));
+
+        if (likely(_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3))) == 0xffff))
+            continue;
+
+        // 在这64字节里
+        for(; ; i += 16) {
+            mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i)),
+                                                    _mm_loadu_si128((const __m128i *)(pb + i))));
+
+            if (mask != 0xffff)
+                return i + __builtin_ctz(~mask);
+        }
+    }
+
+#endif
+
+    for(; i + 8 <= len; i += 8) {
+        memcpy(&wa, pa + i, 8);
+        memcpy(&wb, pb + i, 8);
+
+        if (wa != wb) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return i + (__builtin_ctzll(wa ^ wb) >> 3);
+#else
+            break;
+#endif
+        }
+    }
+
+    for(; i < len; i++) {
+        if (pa[i] != pb[i])
+            return i;
+    }
+
+    return -1;
+}
+
 /**
  * 转成大写
  */
@@ -12,6 +12,7 @@ CTEST_CPP_START
 
 extern char *ctest_strncpy(char *dst, const char *src, size_t n);
 extern char *ctest_string_tohex(const char *str, int n, char *result, int size);
+extern int64_t ctest_string_mismatch(const void *a, const void *b, size_t len);
 extern char *ctest_string_toupper(char *str);
 extern char *ctest_string_tolower(char *str);
 extern char *ctest_string_format_size(double byte, char *buffer, int size);
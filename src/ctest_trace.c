@@ -0,0 +1,286 @@
+#include "ctest_trace.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/**
+ * 事件先存在内存里, close时一次性写成json.
+ * ctest-runner下每个测试进程写自己的文件, pid用runner的, 最后由runner合并
+ */
+
+int                         ctest_trace_enabled = 0;
+static const char           *ctest_trace_filename = NULL;
+static ctest_trace_event_t   *ctest_trace_events = NULL;
+static int                  ctest_trace_size = 0;
+static int                  ctest_trace_cnt = 0;
+static int                  ctest_trace_lane = 0;
+static int                  ctest_trace_pid = 0;
+static pthread_t            ctest_trace_worker;
+static ctest_atomic_t        ctest_trace_lock = 0;
+static __thread int         ctest_trace_tid = -1;
+
+static int ctest_trace_get_tid();
+static ctest_trace_event_t *ctest_trace_new_event();
+static void ctest_trace_write_string(FILE *fp, const char *str);
+static void ctest_trace_format_name(char *name, const char *fmt, va_list args);
+
+/**
+ * 打开trace, 调用的线程作为worker线程, lane从CTEST_WORKER_ID里取
+ */
+int ctest_trace_open(const char *filename)
+{
+    const char              *env;
+
+    ctest_trace_filename = filename;
+    ctest_trace_worker = pthread_self();
+    ctest_trace_lane = ((env = getenv(CTEST_TRACE_WORKER_ENV)) ? atoi(env) : 0);
+    ctest_trace_pid = ((env = getenv(CTEST_TRACE_PID_ENV)) ? atoi(env) : (int)getpid());
+    ctest_trace_cnt = 0;
+    ctest_trace_enabled = 1;
+
+    return CTEST_OK;
+}
+
+/**
+ * 写文件, 释放内存
+ */
+int ctest_trace_close()
+{
+    FILE                    *fp;
+    ctest_trace_event_t      *e;
+    int                     i, ret = CTEST_OK;
+
+    if (ctest_trace_enabled == 0)
+        return CTEST_OK;
+
+    ctest_trace_enabled = 0;
+
+    if ((fp = fopen(ctest_trace_filename, "w")) == NULL) {
+        ret = CTEST_ERROR;
+        goto out;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"worker %d\"}}", ctest_trace_pid, ctest_trace_lane, ctest_trace_lane);
+
+    for(i = 0; i < ctest_trace_cnt; i++) {
+        e = ctest_trace_events + i;
+        fprintf(fp, ",\n{\"name\":");
+        ctest_trace_write_string(fp, e->name);
+
+        if (e->ph == 'C')
+            fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"C\",\"ts\":%" PRId64 ",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"bytes\":%" PRId64 "}}", e->cat, e->ts, ctest_trace_pid, e->tid, e->value);
+        else
+            fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64 ",\"dur\":%" PRId64
+                    ",\"pid\":%d,\"tid\":%d}", e->cat, e->ts, e->dur, ctest_trace_pid, e->tid);
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0)
+        ret = CTEST_ERROR;
+
+out:
+    ctest_free(ctest_trace_events);
+    ctest_trace_events = NULL;
+    ctest_trace_size = ctest_trace_cnt = 0;
+    return ret;
+}
+
+/**
+ * 把各个测试进程的trace合并成一个文件, 每个worker一个lane, 合并完删掉原来的
+ */
+int ctest_trace_merge(const char *filename, char **files, int cnt, int lanes)
+{
+    FILE                    *fp, *in;
+    char                    line[4096];
+    int                     i, len, first = 1, ret = CTEST_OK;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        return CTEST_ERROR;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for(i = 0; i < lanes; i++, first = 0) {
+        fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"worker %d\"}}", (first ? "" : ","), (int)getpid(), i, i);
+    }
+
+    for(i = 0; i < cnt; i++) {
+        if ((in = fopen(files[i], "r")) == NULL)
+            continue;
+
+        // 一行一个事件, lane的名字上面已经写过了
+        while (fgets(line, sizeof(line), in)) {
+            len = strlen(line);
+
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == ',')) line[--len] = '\0';
+
+            if (strncmp(line, "{\"name\":", 8) != 0 || strstr(line, "\"ph\":\"M\""))
+                continue;
+
+            fprintf(fp, "%s\n%s", (first ? "" : ","), line);
+            first = 0;
+        }
+
+        fclose(in);
+        unlink(files[i]);
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0)
+        ret = CTEST_ERROR;
+
+    return ret;
+}
+
+/**
+ * 单调时钟, 微秒
+ */
+int64_t ctest_trace_now()
+{
+    struct timespec         ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/**
+ * 记录一个[start, end)的span
+ */
+void ctest_trace_span(const char *cat, int64_t start, int64_t end, const char *fmt, ...)
+{
+    ctest_trace_event_t      *e;
+    va_list                 args;
+
+    if (ctest_trace_enabled == 0)
+        return;
+
+    ctest_spin_lock(&ctest_trace_lock);
+
+    if ((e = ctest_trace_new_event()) == NULL) {
+        ctest_spin_unlock(&ctest_trace_lock);
+        return;
+    }
+
+    e->ph = 'X';
+    e->cat = cat;
+    e->ts = start;
+    e->dur = end - start;
+    e->tid = ctest_trace_get_tid();
+    va_start(args, fmt);
+    ctest_trace_format_name(e->name, fmt, args);
+    va_end(args);
+    ctest_spin_unlock(&ctest_trace_lock);
+}
+
+/**
+ * counter事件, 比如测试的内存峰值
+ */
+void ctest_trace_counter(const char *cat, int64_t ts, int64_t value, const char *fmt, ...)
+{
+    ctest_trace_event_t      *e;
+    va_list                 args;
+
+    if (ctest_trace_enabled == 0)
+        return;
+
+    ctest_spin_lock(&ctest_trace_lock);
+
+    if ((e = ctest_trace_new_event()) == NULL) {
+        ctest_spin_unlock(&ctest_trace_lock);
+        return;
+    }
+
+    e->ph = 'C';
+    e->cat = cat;
+    e->ts = ts;
+    e->dur = 0;
+    e->value = value;
+    e->tid = ctest_trace_get_tid();
+    va_start(args, fmt);
+    ctest_trace_format_name(e->name, fmt, args);
+    va_end(args);
+    ctest_spin_unlock(&ctest_trace_lock);
+}
+
+void ctest_trace_scope_end(ctest_trace_scope_t *scope)
+{
+    if (ctest_trace_enabled && scope->start)
+        ctest_trace_span("user", scope->start, ctest_trace_now(), "%s", scope->name);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// 加锁以后调用
+static ctest_trace_event_t *ctest_trace_new_event()
+{
+    ctest_trace_event_t      *e;
+    int                     size;
+
+    if (ctest_trace_cnt == ctest_trace_size) {
+        size = ctest_max(ctest_trace_size * 2, 1024);
+        e = (ctest_trace_event_t *)ctest_realloc(ctest_trace_events, size * sizeof(ctest_trace_event_t));
+
+        if (e == NULL)
+            return NULL;
+
+        ctest_trace_events = e;
+        ctest_trace_size = size;
+    }
+
+    return ctest_trace_events + ctest_trace_cnt++;
+}
+
+// worker线程在自己的lane上, 测试里起的线程用tid
+static int ctest_trace_get_tid()
+{
+    if (unlikely(ctest_trace_tid < 0)) {
+        if (pthread_equal(pthread_self(), ctest_trace_worker))
+            ctest_trace_tid = ctest_trace_lane;
+        else
+            ctest_trace_tid = (int)syscall(SYS_gettid);
+    }
+
+    return ctest_trace_tid;
+}
+
+// 截断时不留半个utf-8字符
+static void ctest_trace_format_name(char *name, const char *fmt, va_list args)
+{
+    int                     len, i, n;
+
+    if ((len = vsnprintf(name, CTEST_TRACE_NAME_SIZE, fmt, args)) < CTEST_TRACE_NAME_SIZE)
+        return;
+
+    len = CTEST_TRACE_NAME_SIZE - 1;
+
+    for(i = len; i > 0 && (name[i - 1] & 0xc0) == 0x80; i--);
+
+    if (i == 0 || (name[i - 1] & 0x80) == 0)
+        return;
+
+    // name[i - 1]是开头的字节, 算出这个字符要几个字节
+    for(n = 0; n < 4 && (name[i - 1] & (0x80 >> n)); n++);
+
+    if (i - 1 + n > len)
+        name[i - 1] = '\0';
+}
+
+static void ctest_trace_write_string(FILE *fp, const char *str)
+{
+    const unsigned char     *p;
+
+    fputc('"', fp);
+
+    for(p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(fp, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(fp, "\\u%04x", *p);
+        else
+            fputc(*p, fp);
+    }
+
+    fputc('"', fp);
+}
@@ -0,0 +1,57 @@
+#ifndef CTEST_TRACE_H_
+#define CTEST_TRACE_H_
+
+/**
+ * 输出chrome trace-event格式的json, 用chrome://tracing或perfetto查看
+ */
+#include "ctest_define.h"
+#include "ctest_atomic.h"
+
+CTEST_CPP_START
+
+#define CTEST_TRACE_NAME_SIZE        64
+#define CTEST_TRACE_WORKER_ENV       "CTEST_WORKER_ID"
+#define CTEST_TRACE_FILE_ENV         "CTEST_TRACE_FILE"
+#define CTEST_TRACE_PID_ENV          "CTEST_TRACE_PID"
+
+typedef struct ctest_trace_event_t ctest_trace_event_t;
+typedef struct ctest_trace_scope_t ctest_trace_scope_t;
+
+struct ctest_trace_event_t {
+    char                    name[CTEST_TRACE_NAME_SIZE];
+    const char              *cat;
+    int64_t                 ts;
+    int64_t                 dur;
+    int64_t                 value;
+    int                     tid;
+    char                    ph;
+};
+
+struct ctest_trace_scope_t {
+    const char              *name;
+    int64_t                 start;
+};
+
+extern int                  ctest_trace_enabled;
+
+extern int ctest_trace_open(const char *filename);
+extern int ctest_trace_close();
+extern int ctest_trace_merge(const char *filename, char **files, int cnt, int lanes);
+extern int64_t ctest_trace_now();
+extern void ctest_trace_span(const char *cat, int64_t start, int64_t end, const char *fmt, ...)
+__attribute__ ((__format__ (__printf__, 4, 5)));
+extern void ctest_trace_counter(const char *cat, int64_t ts, int64_t value, const char *fmt, ...)
+__attribute__ ((__format__ (__printf__, 4, 5)));
+extern void ctest_trace_scope_end(ctest_trace_scope_t *scope);
+
+// 在测试中打点: CTEST_TRACE_SCOPE("name"); 作用域结束时记录一个span
+#define CTEST_TRACE_CONCAT_(a, b)    a##b
+#define CTEST_TRACE_CONCAT(a, b)     CTEST_TRACE_CONCAT_(a, b)
+#define CTEST_TRACE_SCOPE(name)                                                         \
+    ctest_trace_scope_t CTEST_TRACE_CONCAT(ctest_trace_scope_, __LINE__)                 \
+    __attribute__((cleanup(ctest_trace_scope_end))) =                                   \
+            {(name), (ctest_trace_enabled ? ctest_trace_now() : 0)}
+
+CTEST_CPP_END
+
+#endif
@@ -0,0 +1,256 @@
+#include <vector>
+#include <map>
+
+#include "ctest.h"
+#include "ctest_pool.hpp"
+
+struct alignas(64) cxx_aligned_t {
+  char data[64];
+};
+
+// vector扩容时旧的large还给pool, 不会一直挂在pool->large上
+TEST(cxx, allocator_vector) {
+  ctest_pool_t *pool;
+  ctest_pool_stat_t st;
+  int i;
+
+  pool = ctest_pool_create(4096);
+
+  {
+    std::vector<int, ctest_pool_allocator<int> > v((ctest_pool_allocator<int>(pool)));
+
+    for (i = 0; i < 1000000; i++) v.push_back(i);
+
+    for (i = 0; i < 1000000; i++) {
+      if (v[i] != i) break;
+    }
+
+    EXPECT_EQ(i, 1000000);
+    ctest_pool_stats(pool, &st);
+    EXPECT_TRUE(st.large_count <= 2);
+  }
+
+  ctest_pool_destroy(pool);
+}
+
+TEST(cxx, allocator_map) {
+  ctest_pool_t *pool;
+  int i;
+
+  pool = ctest_pool_create(4096);
+
+  {
+    typedef std::map<int, int, std::less<int>, ctest_pool_allocator<std::pair<const int, int> > > map_t;
+    ctest_pool_allocator<std::pair<const int, int> > a(pool);
+    map_t m(a);
+
+    for (i = 0; i < 1000; i++) m[i] = i * 2;
+
+    EXPECT_EQ(m.size(), 1000);
+    EXPECT_EQ(m[500], 1000);
+  }
+
+  ctest_pool_destroy(pool);
+}
+
+// 超过16字节的对齐自己对齐
+TEST(cxx, allocator_align) {
+  ctest_pool_t *pool;
+  cxx_aligned_t *p;
+  int i;
+
+  pool = ctest_pool_create(4096);
+  ctest_pool_allocator<cxx_aligned_t> a(pool);
+
+  for (i = 0; i < 100; i++) {
+    ctest_pool_nalloc(pool, 1 + i % 7);
+    p = a.allocate(1 + i % 3);
+    EXPECT_EQ((uintptr_t)p % 64, 0);
+    a.deallocate(p, 1 + i % 3);
+  }
+
+  ctest_pool_destroy(pool);
+}
+
+// 对齐超过16的vector扩容, 旧的large也还回去
+TEST(cxx, allocator_aligned_vector) {
+  ctest_pool_t *pool;
+  ctest_pool_stat_t st;
+  int i;
+
+  pool = ctest_pool_create(4096);
+
+  {
+    std::vector<cxx_aligned_t, ctest_pool_allocator<cxx_aligned_t> > v((ctest_pool_allocator<cxx_aligned_t>(pool)));
+
+    for (i = 0; i < 20000; i++) {
+      v.push_back(cxx_aligned_t());
+      v.back().data[0] = (char)i;
+    }
+
+    EXPECT_EQ((uintptr_t)v.data() % 64, 0);
+    EXPECT_EQ(v[19999].data[0], (char)19999);
+    ctest_pool_stats(pool, &st);
+    EXPECT_TRUE(st.large_count <= 2);
+    EXPECT_TRUE(st.large_bytes < 4 * 20000 * 64);
+  }
+
+  ctest_pool_destroy(pool);
+}
+
+TEST(cxx, allocator_bad_alloc) {
+  ctest_pool_t *pool;
+  int caught = 0;
+
+  pool = ctest_pool_create(4096);
+  ctest_pool_allocator<char> a(pool);
+
+  try {
+    a.allocate((size_t)UINT32_MAX + 1);
+  } catch (std::bad_alloc &) {
+    caught = 1;
+  }
+
+  EXPECT_EQ(caught, 1);
+  ctest_pool_destroy(pool);
+}
+
+#ifdef CTEST_POOL_HAS_PMR
+TEST(cxx, pmr_resource) {
+  ctest_pool_t *pool;
+  int i;
+
+  pool = ctest_pool_create(4096);
+
+  {
+    ctest_pool_resource r(pool);
+    ctest_pool_resource r2(pool);
+    std::pmr::vector<int> v(&r);
+
+    for (i = 0; i < 100000; i++) v.push_back(i);
+
+    EXPECT_EQ(v[99999], 99999);
+    EXPECT_TRUE(r.is_equal(r2));
+    EXPECT_TRUE(!r.is_equal(*std::pmr::new_delete_resource()));
+  }
+
+  ctest_pool_destroy(pool);
+}
+#endif
+
+static int cxx_dtor_cnt = 0;
+
+struct cxx_dtor_t {
+  ~cxx_dtor_t() { cxx_dtor_cnt ++; }
+};
+
+static void cxx_assert_fail() {
+  cxx_dtor_t d;
+  ASSERT_TRUE(cxx_dtor_cnt < 0);
+  cxx_dtor_cnt += 100;
+}
+
+// ASSERT失败在C++里抛异常, 已经构造的对象会析构
+TEST(cxx, assert_runs_destructor) {
+  int jmp_set;
+
+  ctest_test_quiet = 1;
+  CTEST_TEST_GUARD(cxx_assert_fail)();
+  jmp_set = ctest_test_jmp_set;
+
+  // 不算这个测试失败
+  ctest_test_quiet = 0;
+  ctest_test_retval = 0;
+  ctest_test_jmp_set = 1;
+
+  EXPECT_EQ(jmp_set, 0);
+  EXPECT_EQ(cxx_dtor_cnt, 1);
+}
+
+#define CXX_EQ(a, b) ctest_test_cmp::equal((a), (b))
+#define CXX_PRINT(v) ctest_test_cmp::printer<ctest_test_cmp::kind<decltype(v)>::value>::print(v)
+
+enum class cxx_color_t : uint8_t {red, green, blue};
+
+// 负数不等于任何无符号数, 不会先转成同一个类型
+TEST(cxx, cmp_signedness) {
+  int retval;
+
+  EXPECT_FALSE(CXX_EQ(-1, 0xffffffffu));
+  EXPECT_FALSE(CXX_EQ(-1, (uint64_t)-1));
+  EXPECT_FALSE(CXX_EQ((uint64_t)-1, -1));
+  EXPECT_FALSE(CXX_EQ(INT64_MIN, (uint64_t)1 << 63));
+  EXPECT_TRUE(CXX_EQ((int64_t)5, 5u));
+  EXPECT_TRUE(CXX_EQ((uint8_t)200, 200));
+  EXPECT_TRUE(CXX_EQ(cxx_color_t::blue, 2));
+  EXPECT_FALSE(CXX_EQ(cxx_color_t::red, -256));
+  EXPECT_EQ(CXX_PRINT((uint64_t)-1), "18446744073709551615");
+  EXPECT_EQ(CXX_PRINT((int8_t)-3), "-3");
+  EXPECT_NE(-1, 0xffffffffu);
+  EXPECT_EQ(7u, 7);
+
+  ctest_test_quiet = 1;
+  EXPECT_EQ(-1, 0xffffffffu);
+  retval = ctest_test_retval;
+
+  // 不算这个测试失败
+  ctest_test_quiet = 0;
+  ctest_test_retval = 0;
+
+  EXPECT_EQ(retval, 1);
+}
+
+// 浮点和整数比较不截断小数
+TEST(cxx, cmp_float_int) {
+  EXPECT_TRUE(CXX_EQ(3.0, 3));
+  EXPECT_TRUE(CXX_EQ(3, 3.0f));
+  EXPECT_FALSE(CXX_EQ(0.5, 0));
+  EXPECT_FALSE(CXX_EQ(2, 2.25));
+  EXPECT_TRUE(CXX_EQ(2.5f, 2.5));
+  EXPECT_FALSE(CXX_EQ(0.1 + 0.2, 0.3));
+  EXPECT_EQ(CXX_PRINT(0.1), "0.10000000000000001");
+  EXPECT_EQ(CXX_PRINT(-2.5f), "-2.5");
+  EXPECT_NE(0.5, 0);
+  EXPECT_EQ(1.0, 1);
+}
+
+// 字符串按内容比较, 长度也要一样
+TEST(cxx, cmp_string) {
+  char buf[16] = "hello";
+  const char *null = NULL;
+  std::string s("hello");
+
+  EXPECT_TRUE(CXX_EQ(buf, s));
+  EXPECT_TRUE(CXX_EQ(s, buf));
+  EXPECT_TRUE(CXX_EQ(buf, "hello"));
+  EXPECT_FALSE(CXX_EQ(buf, std::string("hello\0x", 7)));
+  EXPECT_FALSE(CXX_EQ(buf, "hell"));
+  EXPECT_FALSE(CXX_EQ(null, std::string("")));
+  EXPECT_FALSE(CXX_EQ("", null));
+  EXPECT_TRUE(CXX_EQ(null, (char *)NULL));
+#if __cplusplus >= 201703L
+  EXPECT_TRUE(CXX_EQ(std::string_view(buf), s));
+  EXPECT_FALSE(CXX_EQ(std::string_view(buf, 4), buf));
+#endif
+  EXPECT_EQ(CXX_PRINT(null), "(null)");
+  EXPECT_EQ(CXX_PRINT(s), "hello");
+  EXPECT_EQ(buf, s);
+  EXPECT_NE(buf, "world");
+}
+
+// nullptr和任何空指针相等, 包括char *
+TEST(cxx, cmp_nullptr) {
+  int v = 0, *p = &v, *np = NULL;
+  const char *str = "x", *nstr = NULL;
+
+  EXPECT_TRUE(CXX_EQ(nullptr, np));
+  EXPECT_TRUE(CXX_EQ(np, nullptr));
+  EXPECT_FALSE(CXX_EQ(p, nullptr));
+  EXPECT_TRUE(CXX_EQ(nstr, nullptr));
+  EXPECT_FALSE(CXX_EQ(nullptr, str));
+  EXPECT_TRUE(CXX_EQ(nullptr, nullptr));
+  EXPECT_TRUE(CXX_EQ((void *)p, p));
+  EXPECT_EQ(np, nullptr);
+  EXPECT_NE(p, nullptr);
+  EXPECT_EQ(nstr, nullptr);
+}
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ctest.h"
+
+// 写比捕获的大小多得多的stderr, code < 0时abort
+static void death_noisy(int code) {
+  int i;
+
+  fprintf(stderr, "noisy start\n");
+
+  for (i = 0; i < 4096; i++) {
+    fprintf(stderr, "line %04d of stderr that is longer than the capture buffer\n", i);
+  }
+
+  if (code < 0) abort();
+
+  exit(code);
+}
+
+TEST(death, exit_code) {
+  EXPECT_EXIT(exit(3), 3);
+}
+
+TEST(death, abort_regex) {
+  EXPECT_DEATH((fprintf(stderr, "boom %d\n", 42), abort()), "boom 42");
+}
+
+// stderr超过捕获的大小, 子进程也不能因为SIGPIPE死掉
+TEST(death, large_stderr) {
+  EXPECT_EXIT(death_noisy(5), 5);
+  EXPECT_DEATH(death_noisy(-1), "noisy start");
+}
@@ -0,0 +1,169 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ctest.h"
+
+static char golden_out[64];
+static int golden_stdout = -1;
+static int golden_retval = 0;
+
+// 失败信息写到stdout, 先换成文件, 结束时读回来
+static void golden_capture_begin() {
+  int fd;
+
+  snprintf(golden_out, sizeof(golden_out), "/tmp/ctest_golden_%d.out", (int)getpid());
+  fflush(stdout);
+  golden_retval = ctest_test_retval;
+  ctest_test_retval = 0;
+  golden_stdout = dup(1);
+  fd = open(golden_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dup2(fd, 1);
+  close(fd);
+}
+
+// 返回这期间有没有失败, 这期间的失败不算这个测试失败
+static int golden_capture_end(char *buf, int size) {
+  FILE *fp;
+  int n = 0, retval;
+
+  fflush(stdout);
+  dup2(golden_stdout, 1);
+  close(golden_stdout);
+
+  if ((fp = fopen(golden_out, "r")) != NULL) {
+    n = fread(buf, 1, size - 1, fp);
+    fclose(fp);
+  }
+
+  buf[n] = '\0';
+  unlink(golden_out);
+  retval = ctest_test_retval;
+  ctest_test_retval = golden_retval;
+  return retval;
+}
+
+static void golden_write(const char *path, const char *data) {
+  FILE *fp;
+
+  if ((fp = fopen(path, "w")) != NULL) {
+    fputs(data, fp);
+    fclose(fp);
+  }
+}
+
+// 输出不同的位置, 两边的长度, 标出那一行
+TEST(golden, mem_mismatch) {
+  char a[64], b[64], out[4096];
+  int retval;
+
+  memset(a, 'a', sizeof(a));
+  memcpy(b, a, sizeof(b));
+  b[37] = 'b';
+
+  golden_capture_begin();
+  EXPECT_MEM_EQ(a, b, sizeof(a));
+  retval = golden_capture_end(out, sizeof(out));
+
+  EXPECT_EQ(retval, 1);
+  EXPECT_TRUE(strstr(out, "(offset=37, len=64/64)") != NULL);
+  EXPECT_TRUE(strstr(out, "\n> 00000020  a=61616161616161616161616161616161  b=61616161616261616161616161616161") != NULL);
+  EXPECT_TRUE(strstr(out, "\n  00000010") != NULL);
+
+  golden_capture_begin();
+  EXPECT_MEM_EQ(a, a, sizeof(a));
+  retval = golden_capture_end(out, sizeof(out));
+
+  EXPECT_EQ(retval, 0);
+  EXPECT_TRUE(out[0] == '\0');
+}
+
+// 和golden文件比: 内容不同, 长度不同, 文件不存在
+TEST(golden, file_mismatch) {
+  char path[64], out[4096];
+  int retval;
+
+  snprintf(path, sizeof(path), "/tmp/ctest_golden_%d", (int)getpid());
+  golden_write(path, "hello world");
+
+  golden_capture_begin();
+  EXPECT_FILE_EQ("hello world", 11, path);
+  retval = golden_capture_end(out, sizeof(out));
+  EXPECT_EQ(retval, 0);
+
+  golden_capture_begin();
+  EXPECT_FILE_EQ("hello World", 11, path);
+  retval = golden_capture_end(out, sizeof(out));
+  EXPECT_EQ(retval, 1);
+  EXPECT_TRUE(strstr(out, "(offset=6, len=11/11)") != NULL);
+
+  golden_capture_begin();
+  EXPECT_FILE_EQ("hello world!", 12, path);
+  retval = golden_capture_end(out, sizeof(out));
+  EXPECT_EQ(retval, 1);
+  EXPECT_TRUE(strstr(out, "(offset=11, len=12/11)") != NULL);
+
+  // 空文件不mmap
+  golden_write(path, "");
+  golden_capture_begin();
+  EXPECT_FILE_EQ("", 0, path);
+  EXPECT_FILE_EQ("x", 1, path);
+  retval = golden_capture_end(out, sizeof(out));
+  EXPECT_EQ(retval, 1);
+  EXPECT_TRUE(strstr(out, "(offset=0, len=1/0)") != NULL);
+
+  unlink(path);
+  golden_capture_begin();
+  EXPECT_FILE_EQ("hello world", 11, path);
+  retval = golden_capture_end(out, sizeof(out));
+  EXPECT_EQ(retval, 1);
+  EXPECT_TRUE(strstr(out, "run with --update-golden to create it") != NULL);
+}
+
+// 先写临时文件再rename, 原来的文件不会被截断, 不留临时文件
+TEST(golden, update) {
+  char path[64], hard[128], tmp[128], out[4096];
+  struct stat st0, st1;
+  int retval;
+
+  snprintf(path, sizeof(path), "/tmp/ctest_golden_%d", (int)getpid());
+  snprintf(hard, sizeof(hard), "%s.link", path);
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+  golden_write(path, "old");
+  unlink(hard);
+  ASSERT_EQ(link(path, hard), 0);
+  ASSERT_EQ(stat(path, &st0), 0);
+
+  ctest_test_update_golden = 1;
+  golden_capture_begin();
+  EXPECT_FILE_EQ("new content", 11, path);
+  retval = golden_capture_end(out, sizeof(out));
+  ctest_test_update_golden = 0;
+
+  EXPECT_EQ(retval, 0);
+  ASSERT_EQ(stat(path, &st1), 0);
+  EXPECT_NE(st0.st_ino, st1.st_ino);
+  EXPECT_EQ(st1.st_size, 11);
+  EXPECT_TRUE(access(tmp, F_OK) != 0);
+  EXPECT_FILE_EQ("new content", 11, path);
+
+  // 旧的inode没有被改写
+  EXPECT_FILE_EQ("old", 3, hard);
+
+  // 目录不存在, 失败也不留临时文件
+  snprintf(path, sizeof(path), "/tmp/ctest_golden_%d.none/golden", (int)getpid());
+  ctest_test_update_golden = 1;
+  golden_capture_begin();
+  EXPECT_FILE_EQ("x", 1, path);
+  retval = golden_capture_end(out, sizeof(out));
+  ctest_test_update_golden = 0;
+
+  EXPECT_EQ(retval, 1);
+  EXPECT_TRUE(strstr(out, "update /tmp/ctest_golden_") != NULL);
+
+  snprintf(path, sizeof(path), "/tmp/ctest_golden_%d", (int)getpid());
+  unlink(path);
+  unlink(hard);
+}
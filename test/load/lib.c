@@ -0,0 +1,14 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ctest.h"
+
+// --load的测试里dlopen的库, load.collide和test_main里的重名
+TEST(load, collide) {
+  printf("load.collide in so\n");
+}
+
+TEST(load, from_so) {
+  printf("load.from_so in so\n");
+  EXPECT_TRUE(getenv("CTEST_LOAD_FAIL") == NULL);
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ctest.h"
+
+// 和库里的load.collide重名, 两个都要跑, 各跑各的函数
+TEST(load, collide) {
+  if (getenv("CTEST_LOAD_SHOW")) printf("load.collide in main\n");
+}
+
+static int load_count(const char *s, const char *sub) {
+  int n = 0;
+
+  for (; (s = strstr(s, sub)) != NULL; s++) n++;
+
+  return n;
+}
+
+static int load_run(const char *env, char *out, int size) {
+  char self[PATH_MAX], cmd[PATH_MAX + 512];
+  FILE *fp;
+  ssize_t n;
+  int status;
+
+  if ((n = readlink("/proc/self/exe", self, sizeof(self) - 1)) <= 0) return -1;
+
+  self[n] = '\0';
+  snprintf(cmd, sizeof(cmd), "CTEST_LOAD_SHOW=1 %s %s --load=%s/load_lib.so -f 'load.*' 2>&1",
+           env, self, CTEST_TEST_LIBS);
+  fflush(stdout);
+
+  if ((fp = popen(cmd, "r")) == NULL) return -1;
+
+  n = fread(out, 1, size - 1, fp);
+  out[n] = '\0';
+  status = pclose(fp);
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+// 库里的TEST注册到test_main里, 重名的不会被test_main里的同名函数顶掉
+TEST(load, shared_object) {
+  char out[16384];
+
+  if (getenv("CTEST_LOAD_SHOW")) return;
+
+  EXPECT_EQ(load_run("", out, sizeof(out)), 0);
+  EXPECT_EQ(load_count(out, "load.collide in main\n"), 1);
+  EXPECT_EQ(load_count(out, "load.collide in so\n"), 1);
+  EXPECT_EQ(load_count(out, "load.from_so in so\n"), 1);
+  EXPECT_EQ(load_count(out, "load.shared_object"), 2);
+  EXPECT_TRUE(strstr(out, " 5 tests ran.") != NULL);
+
+  // 库里的EXPECT失败算在test_main的结果里
+  EXPECT_NE(load_run("CTEST_LOAD_FAIL=1", out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "ERROR at load/lib.c:") != NULL);
+  EXPECT_TRUE(strstr(out, "load.from_so") != NULL);
+}
+
+// ctest-runner里重名的只排一次, 每个函数只跑一次
+TEST(load, runner) {
+  char cmd[1024], out[16384];
+  FILE *fp;
+  int n, status;
+
+  if (getenv("CTEST_LOAD_SHOW")) return;
+
+  snprintf(cmd, sizeof(cmd), "CTEST_LOAD_SHOW=1 %s -f 'load.*' /proc/%d/exe -- --load=%s/load_lib.so 2>&1",
+           CTEST_TEST_RUNNER, (int)getpid(), CTEST_TEST_LIBS);
+  fflush(stdout);
+  ASSERT_TRUE((fp = popen(cmd, "r")) != NULL);
+  n = fread(out, 1, sizeof(out) - 1, fp);
+  out[n] = '\0';
+  status = pclose(fp);
+  EXPECT_EQ(status, 0);
+
+  EXPECT_TRUE(strstr(out, "Running 4 tests on") != NULL);
+  EXPECT_EQ(load_count(out, "load.collide in main\n"), 1);
+  EXPECT_EQ(load_count(out, "load.collide in so\n"), 1);
+  EXPECT_EQ(load_count(out, "load.from_so in so\n"), 1);
+}
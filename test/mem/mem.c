@@ -0,0 +1,49 @@
+#include <stdlib.h>
+
+#include "ctest.h"
+
+// 不让编译器把malloc/free整个去掉
+char *volatile mem_keep;
+
+// 有预算的测试才统计内存
+TEST_MEM_LIMIT(mem, within_limit, 1024 * 1024);
+
+TEST(mem, within_limit) {
+  EXPECT_TRUE(ctest_test_mem_track);
+  mem_keep = (char *)malloc(256 * 1024);
+  memset(mem_keep, 1, 256 * 1024);
+  EXPECT_TRUE(ctest_test_mem_peak - ctest_test_mem_base >= 256 * 1024);
+  free(mem_keep);
+  EXPECT_TRUE(ctest_test_mem_cur - ctest_test_mem_base < 256 * 1024);
+  EXPECT_FALSE(ctest_test_mem_over);
+}
+
+// 超过预算时测试失败, 只报一次
+TEST_MEM_LIMIT(mem, over_limit, 64 * 1024);
+
+TEST(mem, over_limit) {
+  int retval, over;
+
+  mem_keep = (char *)malloc(256 * 1024);
+  memset(mem_keep, 1, 256 * 1024);
+  free(mem_keep);
+  mem_keep = (char *)malloc(256 * 1024);
+  free(mem_keep);
+  retval = ctest_test_retval;
+  over = ctest_test_mem_over;
+
+  // 不算这个测试失败
+  ctest_test_retval = 0;
+  ctest_test_mem_over = 0;
+  ctest_test_mem_limit = 0;
+
+  EXPECT_EQ(retval, 1);
+  EXPECT_EQ(over, 1);
+}
+
+TEST(mem, format_size) {
+  char buffer[32];
+
+  EXPECT_TRUE(strcmp(ctest_string_format_size(512, buffer, sizeof(buffer)), "512.00") == 0);
+  EXPECT_TRUE(strcmp(ctest_string_format_size(1536, buffer, sizeof(buffer)), "1.50 KB") == 0);
+}
@@ -0,0 +1,704 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "ctest.h"
+#include "ctest_buf.h"
+
+#define POOL_THREADS 4
+#define POOL_ALLOCS  2000
+
+typedef struct pool_thread_t {
+  ctest_pool_t *pool;
+  int id;
+  uint8_t *ptr[POOL_ALLOCS];
+} pool_thread_t;
+
+static void *pool_thread_run(void *arg) {
+  pool_thread_t *pt = (pool_thread_t *)arg;
+  int i;
+
+  for (i = 0; i < POOL_ALLOCS; i++) {
+    pt->ptr[i] = (uint8_t *)ctest_pool_alloc(pt->pool, 24 + i % 40);
+    memset(pt->ptr[i], pt->id, 24 + i % 40);
+  }
+
+  return NULL;
+}
+
+// 每个线程写自己的id, 如果有两次分配重叠了就会被别的线程改掉
+TEST(pool, concurrent_alloc) {
+  pool_thread_t pt[POOL_THREADS];
+  pthread_t tid[POOL_THREADS];
+  ctest_pool_t *pool;
+  int i, j, k, bad = 0;
+
+  pool = ctest_pool_create(4096);
+  ctest_pool_set_concurrent(pool);
+
+  for (i = 0; i < POOL_THREADS; i++) {
+    pt[i].pool = pool;
+    pt[i].id = i + 1;
+    pthread_create(&tid[i], NULL, pool_thread_run, &pt[i]);
+  }
+
+  for (i = 0; i < POOL_THREADS; i++) pthread_join(tid[i], NULL);
+
+  for (i = 0; i < POOL_THREADS; i++) {
+    for (j = 0; j < POOL_ALLOCS; j++) {
+      EXPECT_TRUE(((uintptr_t)pt[i].ptr[j] & (sizeof(long) - 1)) == 0);
+
+      for (k = 0; k < 24 + j % 40; k++) {
+        if (pt[i].ptr[j][k] != i + 1) bad++;
+      }
+    }
+  }
+
+  EXPECT_EQ(bad, 0);
+  ctest_pool_destroy(pool);
+}
+
+// 对齐要求比chunk大也不能越界
+TEST(pool, concurrent_align) {
+  ctest_pool_t *pool;
+  uint8_t *p;
+  int i;
+
+  pool = ctest_pool_create(1024);
+  ctest_pool_set_concurrent(pool);
+
+  for (i = 0; i < 16; i++) {
+    p = (uint8_t *)ctest_pool_alloc_ex(pool, 8, 4096);
+    ASSERT_TRUE(p != NULL);
+    EXPECT_TRUE(((uintptr_t)p & 4095) == 0);
+    memset(p, 0xff, 8);
+    p = (uint8_t *)ctest_pool_alloc_ex(pool, 24, 64);
+    EXPECT_TRUE(((uintptr_t)p & 63) == 0);
+    memset(p, 0xff, 24);
+  }
+
+  ctest_pool_destroy(pool);
+}
+
+// mark以后线程不能再用mark以前拿的chunk
+TEST(pool, concurrent_mark) {
+  ctest_pool_t *pool;
+  ctest_pool_mark_t mark;
+  uint8_t *a, *b, *c;
+
+  pool = ctest_pool_create(8192);
+  ctest_pool_set_concurrent(pool);
+  a = (uint8_t *)ctest_pool_alloc(pool, 16);
+  mark = ctest_pool_mark(pool);
+  b = (uint8_t *)ctest_pool_alloc(pool, 16);
+  EXPECT_TRUE(b != a + 16);
+  ctest_pool_release(pool, &mark);
+  c = (uint8_t *)ctest_pool_alloc(pool, 16);
+  EXPECT_TRUE(c == b);
+  ctest_pool_destroy(pool);
+}
+
+// 数着活着的字节, 看cache留了多少, block是不是还给了分配它的allocator
+static ctest_atomic_t pool_live[2];
+
+static void *pool_count_realloc(ctest_atomic_t *live, void *ptr, size_t size) {
+  char *p = (char *)ptr;
+
+  if (p) {
+    p -= 16;
+    ctest_atomic_add(live, -*(int64_t *)p);
+  }
+
+  if (size == 0) {
+    free(p);
+    return NULL;
+  }
+
+  if ((p = (char *)realloc(p, size + 16)) == NULL) return NULL;
+
+  *(int64_t *)p = size;
+  ctest_atomic_add(live, size);
+  return p + 16;
+}
+
+static void *pool_count_realloc0(void *ptr, size_t size) {
+  return pool_count_realloc(&pool_live[0], ptr, size);
+}
+
+static void *pool_count_realloc1(void *ptr, size_t size) {
+  return pool_count_realloc(&pool_live[1], ptr, size);
+}
+
+static void pool_churn(int n, uint32_t size) {
+  ctest_pool_t *pools[64];
+  int i;
+
+  for (i = 0; i < n; i++) pools[i] = ctest_pool_create(size);
+
+  for (i = 0; i < n; i++) ctest_pool_destroy(pools[i]);
+}
+
+static volatile int pool_churn_done = 0;
+
+static void *pool_churn_thread(void *arg) {
+  pool_churn(16, 64 * 1024);
+  pool_churn_done = 1;
+  // 等主线程flush完再退出
+  pthread_mutex_lock((pthread_mutex_t *)arg);
+  pthread_mutex_unlock((pthread_mutex_t *)arg);
+  return NULL;
+}
+
+TEST(pool, cache_limit) {
+  ctest_pool_t *pool;
+  void *first;
+
+  ctest_pool_cache_flush();
+  pool_live[0] = 0;
+  ctest_pool_set_allocator(pool_count_realloc0);
+  ctest_pool_set_cache_limit(512 * 1024);
+
+  // 同样大小的block从cache里拿回来
+  pool = ctest_pool_create(64 * 1024);
+  first = pool;
+  ctest_pool_destroy(pool);
+  pool = ctest_pool_create(64 * 1024);
+  EXPECT_TRUE((void *)pool == first);
+  ctest_pool_destroy(pool);
+
+  // magazine里的也算在limit里
+  pool_churn(32, 200 * 1024);
+  EXPECT_TRUE(pool_live[0] <= 512 * 1024);
+
+  ctest_pool_set_cache_limit(0);
+  EXPECT_EQ(pool_live[0], 0);
+  ctest_pool_set_allocator(ctest_test_realloc);
+}
+
+TEST(pool, cache_flush_other_thread) {
+  pthread_mutex_t lock;
+  pthread_t tid;
+
+  ctest_pool_cache_flush();
+  pool_live[0] = 0;
+  pthread_mutex_init(&lock, NULL);
+  pthread_mutex_lock(&lock);
+  ctest_pool_set_allocator(pool_count_realloc0);
+  ctest_pool_set_cache_limit(8 * 1024 * 1024);
+  pthread_create(&tid, NULL, pool_churn_thread, &lock);
+
+  while (pool_churn_done == 0) usleep(1000);
+
+  // 线程还活着, 它magazine里的block也要还掉
+  EXPECT_TRUE(pool_live[0] > 0);
+  ctest_pool_cache_flush();
+  EXPECT_EQ(pool_live[0], 0);
+  pthread_mutex_unlock(&lock);
+  pthread_join(tid, NULL);
+
+  ctest_pool_set_cache_limit(0);
+  EXPECT_EQ(pool_live[0], 0);
+  ctest_pool_set_allocator(ctest_test_realloc);
+  pthread_mutex_destroy(&lock);
+}
+
+TEST(pool, cache_allocator) {
+  ctest_pool_t *pool;
+  void *large;
+
+  ctest_pool_cache_flush();
+  pool_live[0] = pool_live[1] = 0;
+  ctest_pool_set_cache_limit(8 * 1024 * 1024);
+  ctest_pool_set_allocator(pool_count_realloc0);
+  pool = ctest_pool_create(64 * 1024);
+  ctest_pool_alloc(pool, 60 * 1024);
+  ctest_pool_alloc(pool, 60 * 1024);
+  EXPECT_TRUE(pool->next != NULL);
+  large = ctest_pool_alloc(pool, 200 * 1024);
+  ctest_pool_alloc(pool, 300 * 1024);
+  EXPECT_TRUE(pool_live[0] > 0);
+
+  // 换了allocator以后扩容和释放, 还是用原来的
+  ctest_pool_set_allocator(pool_count_realloc1);
+  large = ctest_pool_realloc_large(pool, large, 400 * 1024);
+  EXPECT_TRUE(large != NULL);
+  EXPECT_EQ(pool_live[1], 0);
+  ctest_pool_destroy(pool);
+  ctest_pool_set_cache_limit(0);
+  EXPECT_EQ(pool_live[0], 0);
+  EXPECT_EQ(pool_live[1], 0);
+  ctest_pool_set_allocator(ctest_test_realloc);
+}
+
+// 第二个block和第一个一样大, 之后按2倍增长, 到max_block_size为止
+TEST(pool, geometric_growth) {
+  ctest_pool_opt_t opt;
+  ctest_pool_t *pool, *p;
+  uint32_t size, prev;
+  int i, blocks;
+
+  memset(&opt, 0, sizeof(opt));
+  opt.first_size = 1024;
+  opt.max_block_size = 64 * 1024;
+  pool = ctest_pool_create_ex(&opt);
+
+  for (i = 0; i < 1000; i++) memset(ctest_pool_alloc(pool, 500), 1, 500);
+
+  prev = 0;
+  blocks = 0;
+
+  for (p = pool; p; p = p->next) {
+    size = p->end - (uint8_t *)p;
+
+    if (blocks == 1) {
+      EXPECT_EQ(size, prev);
+    } else if (blocks > 1) {
+      EXPECT_EQ(size, ctest_min(prev * 2, 64 * 1024));
+    }
+
+    prev = size;
+    blocks++;
+  }
+
+  // 500K的数据, 不会是几百个1K的block
+  EXPECT_TRUE(blocks < 20);
+  EXPECT_EQ(pool->max, 64 * 1024 - sizeof(ctest_pool_t));
+  ctest_pool_destroy(pool);
+}
+
+// 一次没放下不会跳过窗口里还有空间的block, 窗口外面的tail也会先看
+TEST(pool, scan_window) {
+  ctest_pool_opt_t opt;
+  ctest_pool_stat_t st;
+  ctest_pool_t *pool;
+  uint32_t seed;
+  int i;
+
+  memset(&opt, 0, sizeof(opt));
+  opt.first_size = 4096;
+  opt.max_block_size = 16 * 1024;
+  pool = ctest_pool_create_ex(&opt);
+
+  // 4个block分别剩下约448, 48, 4656, 7224字节
+  ctest_pool_alloc(pool, 4000);
+  ctest_pool_alloc(pool, 4400);
+  ctest_pool_alloc(pool, 4400);
+  ctest_pool_alloc(pool, 9000);
+  ctest_pool_alloc(pool, 7400);
+  ctest_pool_alloc(pool, 7400);
+
+  ctest_pool_stats(pool, &st);
+  EXPECT_EQ(st.blocks, 5);
+  EXPECT_TRUE(st.abandoned < 1024);
+  EXPECT_TRUE(pool->current == pool);
+  ctest_pool_destroy(pool);
+
+  // 随机大小, 用不上的空间不超过5%
+  pool = ctest_pool_create_ex(&opt);
+  seed = 12345;
+
+  for (i = 0; i < 3000; i++) {
+    seed = seed * 1103515245 + 12345;
+    ctest_pool_alloc(pool, 16 + (seed >> 16) % 4000);
+  }
+
+  ctest_pool_stats(pool, &st);
+  EXPECT_TRUE(st.abandoned < st.reserved / 20);
+  ctest_pool_destroy(pool);
+}
+
+// reset以后block挂在spare上, 再分配同样多不用新的block
+TEST(pool, reset_reuse) {
+  ctest_pool_t *pool, *p;
+  ctest_pool_t *blocks[64];
+  int i, n, m;
+
+  pool = ctest_pool_create(1024);
+
+  for (i = 0; i < 500; i++) ctest_pool_alloc(pool, 300);
+
+  for (p = pool->next, n = 0; p && n < 64; p = p->next) blocks[n++] = p;
+
+  ctest_pool_reset(pool);
+  EXPECT_TRUE(pool->next == NULL);
+  EXPECT_TRUE(pool->spare != NULL);
+
+  for (i = 0; i < 500; i++) ctest_pool_alloc(pool, 300);
+
+  for (p = pool->next, m = 0; p && m < 64; p = p->next, m++) EXPECT_TRUE(p == blocks[m]);
+
+  EXPECT_EQ(m, n);
+  ctest_pool_destroy(pool);
+}
+
+// free_large以后进cache, 差不多大的再分配直接拿回来
+TEST(pool, free_large) {
+  ctest_pool_t *pool;
+  void *a, *b;
+
+  pool = ctest_pool_create(1024);
+  a = ctest_pool_alloc(pool, 100 * 1024);
+  EXPECT_TRUE(ctest_pool_large_base(pool, a) == a);
+  ctest_pool_free_large(pool, a);
+  EXPECT_TRUE(pool->large == NULL);
+  EXPECT_TRUE(ctest_pool_large_base(pool, a) == NULL);
+
+  b = ctest_pool_alloc(pool, 90 * 1024);
+  EXPECT_TRUE(b == a);
+  EXPECT_TRUE(ctest_pool_large_base(pool, b) == b);
+  ctest_pool_destroy(pool);
+}
+
+// 扩容以后数据还在
+TEST(pool, realloc_large) {
+  ctest_pool_t *pool;
+  uint8_t *a;
+  int i;
+
+  pool = ctest_pool_create(1024);
+  a = (uint8_t *)ctest_pool_alloc(pool, 64 * 1024);
+
+  for (i = 0; i < 64 * 1024; i++) a[i] = i % 251;
+
+  a = (uint8_t *)ctest_pool_realloc_large(pool, a, 1024 * 1024);
+  ASSERT_TRUE(a != NULL);
+  memset(a + 64 * 1024, 0, 1024 * 1024 - 64 * 1024);
+
+  for (i = 0; i < 64 * 1024; i++) {
+    if (a[i] != i % 251) break;
+  }
+
+  EXPECT_EQ(i, 64 * 1024);
+  EXPECT_TRUE(ctest_pool_large_base(pool, a) == a);
+  ctest_pool_destroy(pool);
+}
+
+// 对齐超过16的large, 头也在数据前面, free/realloc/large_base都能用
+TEST(pool, large_aligned) {
+  ctest_pool_t *pool;
+  uint8_t *a, *b;
+  int i;
+
+  pool = ctest_pool_create(1024);
+
+  for (i = 0; i < 8; i++) {
+    a = (uint8_t *)ctest_pool_alloc_ex(pool, 100 * 1024, 4096);
+    ASSERT_TRUE(a != NULL);
+    EXPECT_EQ((uintptr_t)a % 4096, 0);
+    EXPECT_TRUE(ctest_pool_large_base(pool, a) == a);
+    memset(a, i, 100 * 1024);
+
+    b = (uint8_t *)ctest_pool_realloc_large(pool, a, 300 * 1024);
+    ASSERT_TRUE(b != NULL);
+    EXPECT_EQ((uintptr_t)b % 4096, 0);
+    EXPECT_EQ(b[100 * 1024 - 1], i);
+    ctest_pool_free_large(pool, b);
+  }
+
+  EXPECT_TRUE(pool->large == NULL);
+
+  // cache里拿回来的也要对齐
+  a = (uint8_t *)ctest_pool_alloc_ex(pool, 250 * 1024, 64);
+  EXPECT_EQ((uintptr_t)a % 64, 0);
+  ctest_pool_free_large(pool, a);
+  ctest_pool_destroy(pool);
+}
+
+// 读buffer到了large上, 再扩容时先挪到开头, 数据不丢
+TEST(pool, buf_large) {
+  ctest_pool_t *pool;
+  ctest_buf_t *b;
+  int i;
+
+  pool = ctest_pool_create(1024);
+  b = ctest_buf_create(pool, 0);
+
+  for (i = 0; i < 200; i++) {
+    ASSERT_EQ(ctest_buf_check_read_space(pool, b, 4096), CTEST_OK);
+    memset(b->last, i, 4096);
+    b->last += 4096;
+
+    // 前面的数据读掉一半
+    if (i % 2) b->pos += 4096;
+  }
+
+  EXPECT_TRUE(b->flags & CTEST_BUF_LARGE);
+  EXPECT_TRUE(ctest_pool_large_base(pool, b->start) == b->start);
+  EXPECT_EQ(b->last - b->pos, 100 * 4096);
+
+  for (i = 0; i < 100; i++) {
+    if (b->pos[i * 4096] != (char)(100 + i)) break;
+  }
+
+  EXPECT_EQ(i, 100);
+  ctest_pool_destroy(pool);
+}
+
+// peak在block分配时也要更新, 释放large以后还记得最高的时候
+TEST(pool, peak) {
+  ctest_pool_t *pool;
+  ctest_pool_stat_t st;
+  void *large;
+  int i;
+
+  pool = ctest_pool_create(4096);
+  large = ctest_pool_alloc(pool, 100 * 1024);
+
+  for (i = 0; i < 1000; i++) ctest_pool_alloc(pool, 1024);
+
+  ctest_pool_free_large(pool, large);
+  ctest_pool_stats(pool, &st);
+  EXPECT_EQ(st.requested, 1000 * 1024);
+  EXPECT_EQ(st.peak, 1100 * 1024);
+
+  // reset以后requested清零, peak保留
+  ctest_pool_reset(pool);
+  ctest_pool_alloc(pool, 1024);
+  ctest_pool_stats(pool, &st);
+  EXPECT_EQ(st.requested, 1024);
+  EXPECT_EQ(st.peak, 1100 * 1024);
+  ctest_pool_destroy(pool);
+}
+
+// cleanup只占自己的大小, pool头不随统计和登记变大
+TEST(pool, header_size) {
+  ctest_pool_t *pool;
+  uint8_t *a, *b;
+
+  EXPECT_TRUE(sizeof(ctest_pool_t) <= 160);
+
+  pool = ctest_pool_create(1024);
+  a = (uint8_t *)ctest_pool_alloc(pool, 8);
+  ctest_pool_cleanup_new(pool, NULL, NULL);
+  b = (uint8_t *)ctest_pool_alloc(pool, 8);
+  EXPECT_EQ(b - a, 8 + sizeof(ctest_pool_cleanup_t));
+  EXPECT_TRUE(pool->ext == NULL);
+
+  // 用到large cache和登记表时才分配
+  ctest_pool_free_large(pool, ctest_pool_alloc(pool, 100 * 1024));
+  EXPECT_TRUE(pool->ext != NULL);
+  ctest_pool_destroy(pool);
+
+  ctest_pool_set_registry(1);
+  pool = ctest_pool_create(1024);
+  EXPECT_TRUE(pool->ext != NULL);
+  ctest_pool_destroy(pool);
+  ctest_pool_set_registry(0);
+}
+
+static int pool_all_zero(const void *ptr, uint32_t size) {
+  const uint8_t *p = (const uint8_t *)ptr;
+  uint32_t i;
+
+  for (i = 0; i < size; i++) {
+    if (p[i]) return 0;
+  }
+
+  return 1;
+}
+
+// 写脏以后reset/clear/release, 同一段内存再calloc出来要是0
+TEST(pool, calloc_reuse) {
+  ctest_pool_t *pool;
+  ctest_pool_mark_t mark;
+  void *p;
+  int i;
+
+  pool = ctest_pool_create(64 * 1024);
+
+  for (i = 0; i < 200; i++) memset(ctest_pool_alloc(pool, 1000), 0xff, 1000);
+
+  ctest_pool_reset(pool);
+
+  for (i = 0; i < 200; i++) {
+    p = ctest_pool_calloc(pool, 1000);
+    if (!pool_all_zero(p, 1000)) break;
+  }
+
+  EXPECT_EQ(i, 200);
+
+  mark = ctest_pool_mark(pool);
+  memset(ctest_pool_alloc(pool, 3000), 0xff, 3000);
+  ctest_pool_release(pool, &mark);
+  EXPECT_TRUE(pool_all_zero(ctest_pool_calloc(pool, 3000), 3000));
+
+  memset(ctest_pool_alloc(pool, 5000), 0xff, 5000);
+  ctest_pool_clear(pool);
+  EXPECT_TRUE(pool_all_zero(ctest_pool_calloc(pool, 5000), 5000));
+
+  // large从cache里拿回来的也要清
+  p = ctest_pool_alloc(pool, 200 * 1024);
+  memset(p, 0xff, 200 * 1024);
+  ctest_pool_free_large(pool, p);
+  p = ctest_pool_calloc(pool, 200 * 1024);
+  EXPECT_TRUE(pool_all_zero(p, 200 * 1024));
+  ctest_pool_destroy(pool);
+}
+
+// block cache里的block是脏的, 拿回来calloc也要清
+TEST(pool, calloc_cached_block) {
+  ctest_pool_t *pool;
+  int i;
+
+  ctest_pool_set_cache_limit(8 * 1024 * 1024);
+  pool = ctest_pool_create(64 * 1024);
+  memset(ctest_pool_alloc(pool, 60 * 1024), 0xff, 60 * 1024);
+  ctest_pool_destroy(pool);
+
+  pool = ctest_pool_create(64 * 1024);
+  EXPECT_TRUE(pool_all_zero(ctest_pool_calloc(pool, 60 * 1024), 60 * 1024));
+
+  for (i = 0; i < 10; i++) EXPECT_TRUE(pool_all_zero(ctest_pool_calloc(pool, 30 * 1024), 30 * 1024));
+
+  ctest_pool_destroy(pool);
+  ctest_pool_set_cache_limit(0);
+}
+
+TEST(pool, calloc_array) {
+  ctest_pool_t *pool;
+
+  pool = ctest_pool_create(1024);
+  EXPECT_TRUE(ctest_pool_calloc_array(pool, 0x10000, 0x10000) == NULL);
+  EXPECT_TRUE(pool_all_zero(ctest_pool_calloc_array(pool, 10, 16), 160));
+  ctest_pool_destroy(pool);
+}
+
+static int pool_cleanup_cnt;
+
+static void pool_cleanup_count(const void *data) {
+  pool_cleanup_cnt++;
+}
+
+static void pool_add_cleanup(ctest_pool_t *pool) {
+  ctest_pool_cleanup_reg(pool, ctest_pool_cleanup_new(pool, NULL, pool_cleanup_count));
+}
+
+// release回到mark: mark以后的cleanup要跑, 分配的空间再用
+TEST(pool, mark_release) {
+  ctest_pool_t *pool;
+  ctest_pool_mark_t m1, m2;
+  ctest_pool_stat_t st1, st2;
+  uint8_t *a, *b, *c;
+  int i;
+
+  pool_cleanup_cnt = 0;
+  pool = ctest_pool_create(1024);
+  ctest_pool_alloc(pool, 100);
+  pool_add_cleanup(pool);
+
+  m1 = ctest_pool_mark(pool);
+  a = (uint8_t *)ctest_pool_alloc(pool, 100);
+  pool_add_cleanup(pool);
+
+  ctest_pool_stats(pool, &st1);
+  m2 = ctest_pool_mark(pool);
+  b = (uint8_t *)ctest_pool_alloc(pool, 500);
+
+  for (i = 0; i < 100; i++) ctest_pool_alloc(pool, 500);
+
+  ctest_pool_alloc(pool, 100 * 1024);
+  pool_add_cleanup(pool);
+
+  // 里面的mark
+  ctest_pool_release(pool, &m2);
+  EXPECT_EQ(pool_cleanup_cnt, 1);
+  EXPECT_TRUE(pool->large == NULL);
+  ctest_pool_stats(pool, &st2);
+  EXPECT_EQ(st2.requested, st1.requested);
+  EXPECT_TRUE(ctest_pool_alloc(pool, 500) == b);
+
+  // 外面的mark
+  ctest_pool_release(pool, &m1);
+  EXPECT_EQ(pool_cleanup_cnt, 2);
+  c = (uint8_t *)ctest_pool_alloc(pool, 100);
+  EXPECT_TRUE(c == a);
+
+  ctest_pool_destroy(pool);
+  EXPECT_EQ(pool_cleanup_cnt, 3);
+}
+
+// 子pool的头和block都在parent的内存里
+static int pool_in_parent(ctest_pool_t *parent, void *ptr) {
+  ctest_pool_t *p;
+  ctest_pool_large_t *l;
+
+  for (p = parent; p; p = p->next) {
+    if ((uint8_t *)ptr >= (uint8_t *)p && (uint8_t *)ptr < p->end) return 1;
+  }
+
+  for (l = parent->large; l; l = l->next) {
+    if ((uint8_t *)ptr > (uint8_t *)l && (uint8_t *)ptr < (uint8_t *)l + l->size) return 1;
+  }
+
+  return 0;
+}
+
+TEST(pool, child_in_parent) {
+  ctest_pool_t *parent, *child, *p;
+  int i, n;
+
+  parent = ctest_pool_create(64 * 1024);
+  child = ctest_pool_create_child(parent, 1024);
+  EXPECT_TRUE(pool_in_parent(parent, child));
+
+  for (i = 0; i < 100; i++) memset(ctest_pool_alloc(child, 1000), i, 1000);
+
+  for (p = child, n = 0; p; p = p->next, n++) {
+    if (pool_in_parent(parent, p) == 0) break;
+  }
+
+  EXPECT_TRUE(p == NULL);
+  EXPECT_TRUE(n > 1);
+  ctest_pool_destroy(child);
+  ctest_pool_destroy(parent);
+}
+
+// 子pool从parent的large分的block, destroy时还回去
+TEST(pool, child_large_returned) {
+  ctest_pool_t *parent, *child;
+
+  parent = ctest_pool_create(1024);
+  child = ctest_pool_create_child(parent, 4096);
+  EXPECT_TRUE(parent->large != NULL);
+  EXPECT_TRUE(child->flags & CTEST_POOL_FLAG_FROM_LARGE);
+
+  ctest_pool_alloc(child, 3000);
+  ctest_pool_alloc(child, 3000);
+  ctest_pool_alloc(child, 3000);
+  EXPECT_TRUE(child->next != NULL);
+
+  ctest_pool_destroy(child);
+  EXPECT_TRUE(parent->large == NULL);
+  ctest_pool_destroy(parent);
+}
+
+// 子pool活着时parent的ref不为0, destroy以后parent才能回到mark
+TEST(pool, child_pins_parent) {
+  ctest_pool_t *parent, *child, *grand;
+  ctest_pool_mark_t mark;
+  uint8_t *a;
+
+  pool_cleanup_cnt = 0;
+  parent = ctest_pool_create(64 * 1024);
+  mark = ctest_pool_mark(parent);
+  a = (uint8_t *)ctest_pool_alloc(parent, 100);
+
+  child = ctest_pool_create_child(parent, 1024);
+  grand = ctest_pool_create_child(child, 1024);
+  EXPECT_EQ(parent->ref, 1);
+  EXPECT_EQ(child->ref, 1);
+  pool_add_cleanup(child);
+  pool_add_cleanup(grand);
+  ctest_pool_alloc(grand, 5000);
+
+  ctest_pool_destroy(grand);
+  EXPECT_EQ(child->ref, 0);
+  ctest_pool_destroy(child);
+  EXPECT_EQ(parent->ref, 0);
+  EXPECT_EQ(pool_cleanup_cnt, 2);
+
+  // 子pool用过的都在mark以后, 一起回收
+  ctest_pool_release(parent, &mark);
+  EXPECT_TRUE(ctest_pool_alloc(parent, 100) == a);
+  ctest_pool_destroy(parent);
+  EXPECT_EQ(pool_cleanup_cnt, 2);
+}
@@ -0,0 +1,58 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ctest.h"
+
+// 符号要在动态符号表里才能认出来, 不能是static
+__attribute__((noinline)) uint64_t profile_hot_loop(uint64_t n) {
+  volatile uint64_t x = 0;
+  uint64_t i;
+
+  for (i = 0; i < n; i++) x += i * i;
+
+  return x;
+}
+
+// 只有下面带--profile跑的时候才转
+TEST(profile, spin) {
+  clock_t end;
+
+  if (getenv("CTEST_PROFILE_SPIN") == NULL) return;
+
+  end = clock() + CLOCKS_PER_SEC / 3;
+
+  while (clock() < end) profile_hot_loop(100000);
+}
+
+TEST(profile, folded) {
+  char dir[64], self[PATH_MAX], cmd[PATH_MAX + 256], buf[65536];
+  ssize_t n;
+  int fd;
+
+  snprintf(dir, sizeof(dir), "/tmp/ctest_profile_XXXXXX");
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  ASSERT_TRUE((n = readlink("/proc/self/exe", self, sizeof(self) - 1)) > 0);
+  self[n] = '\0';
+
+  snprintf(cmd, sizeof(cmd), "CTEST_PROFILE_SPIN=1 %s --profile=%s -f profile.spin > /dev/null 2>&1", self, dir);
+  EXPECT_EQ(system(cmd), 0);
+
+  snprintf(cmd, sizeof(cmd), "%s/profile.spin.folded", dir);
+  fd = open(cmd, O_RDONLY);
+  EXPECT_TRUE(fd >= 0);
+  n = (fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : 0);
+  buf[n > 0 ? n : 0] = '\0';
+
+  if (fd >= 0) close(fd);
+
+  EXPECT_TRUE(n > 0);
+  EXPECT_TRUE(strstr(buf, "profile_hot_loop") != NULL);
+
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  EXPECT_EQ(system(cmd), 0);
+}
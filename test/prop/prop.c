@@ -0,0 +1,89 @@
+#include <stdio.h>
+
+#include "ctest.h"
+#include "ctest_prop.h"
+
+// 最后一次(show=1)重放的值和seed, 还有第一个失败的值
+static int64_t prop_a, prop_b, prop_first;
+static uint64_t prop_seed;
+
+// a + b >= 1000时失败, 缩小以后正好在边界上
+static int prop_sum_check(ctest_prop_t *prop, void *args) {
+  int64_t a, b;
+
+  a = ctest_prop_int(prop, 0, 1000000);
+  b = ctest_prop_int(prop, 0, 1000000);
+
+  if (a + b < 1000) return 0;
+
+  if (prop->replay == 0 && prop_first < 0) prop_first = a + b;
+
+  if (prop->show) {
+    prop_a = a;
+    prop_b = b;
+    prop_seed = prop->seed;
+  }
+
+  return 1;
+}
+
+static int prop_pass_check(ctest_prop_t *prop, void *args) {
+  return (ctest_prop_int(prop, 0, 1000) > 1000);
+}
+
+static int prop_run(int jobs, uint64_t seed) {
+  int ret, saved_jobs;
+  uint64_t saved_seed;
+
+  saved_jobs = ctest_prop_jobs;
+  saved_seed = ctest_prop_seed;
+  ctest_prop_jobs = jobs;
+  ctest_prop_seed = seed;
+  prop_a = prop_b = prop_first = -1;
+
+  ret = ctest_prop_run("prop.sum", prop_sum_check, NULL);
+
+  ctest_prop_jobs = saved_jobs;
+  ctest_prop_seed = saved_seed;
+  return ret;
+}
+
+// 缩小到边界上
+TEST(prop, shrink) {
+  EXPECT_EQ(prop_run(1, 0), CTEST_ERROR);
+  EXPECT_EQ(prop_a + prop_b, 1000);
+  EXPECT_TRUE(prop_seed != 0);
+}
+
+// --prop-seed重放同一个反例, 缩小的结果也一样
+TEST(prop, seed_replay) {
+  uint64_t seed;
+  int64_t first, a;
+
+  EXPECT_EQ(prop_run(1, 0), CTEST_ERROR);
+  seed = prop_seed;
+  first = prop_first;
+  a = prop_a;
+
+  EXPECT_EQ(prop_run(1, seed), CTEST_ERROR);
+  EXPECT_EQ(prop_first, first);
+  EXPECT_TRUE(prop_seed == seed);
+  EXPECT_EQ(prop_a, a);
+  EXPECT_EQ(prop_a + prop_b, 1000);
+}
+
+// fork出去找, 在父进程里缩小和重放
+TEST(prop, jobs) {
+  int saved;
+
+  EXPECT_EQ(prop_run(4, 0), CTEST_ERROR);
+  EXPECT_EQ(prop_a + prop_b, 1000);
+
+  EXPECT_EQ(prop_run(1, prop_seed), CTEST_ERROR);
+  EXPECT_EQ(prop_a + prop_b, 1000);
+
+  saved = ctest_prop_jobs;
+  ctest_prop_jobs = 4;
+  EXPECT_EQ(ctest_prop_run("prop.pass", prop_pass_check, NULL), CTEST_OK);
+  ctest_prop_jobs = saved;
+}
@@ -0,0 +1,4 @@
+// ctest-runner的cache测试里当依赖的so, 两个版本的build-id不一样
+int runner_dep_version() {
+  return RUNNER_DEP;
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ctest.h"
+
+// ctest-runner测试里跑的程序, 用环境变量控制哪些测试失败
+
+TEST(fixture, pass) {
+  EXPECT_TRUE(1);
+}
+
+TEST(fixture, fail) {
+  EXPECT_TRUE(getenv("CTEST_FIXTURE_FAIL") == NULL);
+}
+
+TEST(fixture, crash) {
+  if (getenv("CTEST_FIXTURE_CRASH")) abort();
+}
+
+// 分几次输出, 和其他slot同时跑
+TEST(fixture, slow) {
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    printf("slow %d\n", i);
+    fflush(stdout);
+    usleep(100 * 1000);
+  }
+}
+
+RUN_TEST_MAIN
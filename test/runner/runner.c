@@ -0,0 +1,268 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ctest.h"
+
+// 跑一个命令, stdout和stderr都放到buf里, 返回退出码
+static int runner_exec(const char *cmd, char *buf, int size) {
+  FILE *fp;
+  char line[512];
+  int n, status;
+
+  snprintf(line, sizeof(line), "%s 2>&1", cmd);
+  buf[0] = '\0';
+
+  if ((fp = popen(line, "r")) == NULL) return -1;
+
+  n = fread(buf, 1, size - 1, fp);
+  buf[n] = '\0';
+  status = pclose(fp);
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+// 常驻的参数放在请求前面, 请求里的同名选项覆盖它
+TEST(runner, serve_connect) {
+  char sock[64], cmd[512], out[16384];
+  struct stat st;
+  pid_t pid;
+  int i;
+
+  snprintf(sock, sizeof(sock), "/tmp/ctest_serve_%d.sock", (int)getpid());
+  unlink(sock);
+  fflush(stdout);
+
+  if ((pid = fork()) == 0) {
+    if (freopen("/dev/null", "w", stdout) == NULL) _exit(127);
+
+    execl("/proc/self/exe", "test_main", "--serve", sock, "-f", "mem.format_size", (char *)NULL);
+    _exit(127);
+  }
+
+  ASSERT_TRUE(pid > 0);
+
+  for (i = 0; i < 500 && stat(sock, &st) != 0; i++) usleep(10000);
+
+  snprintf(cmd, sizeof(cmd), "%s --connect=%s", CTEST_TEST_RUNNER, sock);
+  EXPECT_EQ(runner_exec(cmd, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "mem.format_size") != NULL);
+  EXPECT_TRUE(strstr(out, "mem.within_limit") == NULL);
+  EXPECT_TRUE(strstr(out, " 1 tests ran") != NULL);
+
+  snprintf(cmd, sizeof(cmd), "%s --connect=%s -f mem.within_limit", CTEST_TEST_RUNNER, sock);
+  EXPECT_EQ(runner_exec(cmd, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "mem.within_limit") != NULL);
+  EXPECT_TRUE(strstr(out, "mem.format_size") == NULL);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  unlink(sock);
+}
+
+// 去掉颜色, 比较起来简单
+static void runner_strip(char *s) {
+  char *p, *q;
+
+  for (p = q = s; *p; p++) {
+    if (*p == '\033') {
+      while (*p && *p != 'm') p++;
+
+      if (*p == '\0') break;
+
+      continue;
+    }
+
+    *q++ = *p;
+  }
+
+  *q = '\0';
+}
+
+static int runner_fixture(const char *env, const char *opts, char *out, int size) {
+  char cmd[1024];
+  int ret;
+
+  snprintf(cmd, sizeof(cmd), "%s %s %s", env, CTEST_TEST_RUNNER, opts);
+  ret = runner_exec(cmd, out, size);
+  runner_strip(out);
+  return ret;
+}
+
+// 失败和崩溃都算进退出码和汇总, 列不出测试的程序直接失败
+TEST(runner, exit_code) {
+  char out[32768];
+
+  EXPECT_EQ(runner_fixture("", "-j 4 " CTEST_TEST_FIXTURE, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "4 tests from 1 binaries") != NULL);
+  EXPECT_TRUE(strstr(out, "[  PASSED  ] 4 tests.") != NULL);
+
+  EXPECT_EQ(runner_fixture("CTEST_FIXTURE_FAIL=1 CTEST_FIXTURE_CRASH=1",
+                           "-j 4 " CTEST_TEST_FIXTURE, out, sizeof(out)), 1);
+  EXPECT_TRUE(strstr(out, "fixture.crash killed by signal 6") != NULL);
+  EXPECT_TRUE(strstr(out, "[  PASSED  ] 2 tests.") != NULL);
+  EXPECT_TRUE(strstr(out, "[  FAILED  ] " CTEST_TEST_FIXTURE " fixture.fail") != NULL);
+  EXPECT_TRUE(strstr(out, " 2 FAILED TEST") != NULL);
+
+  // 两个程序的失败合在一起
+  EXPECT_EQ(runner_fixture("CTEST_FIXTURE_FAIL=1", "-j 4 " CTEST_TEST_FIXTURE " " CTEST_TEST_FIXTURE,
+                           out, sizeof(out)), 1);
+  EXPECT_TRUE(strstr(out, "8 tests from 2 binaries") != NULL);
+  EXPECT_TRUE(strstr(out, " 2 FAILED TEST") != NULL);
+
+  // 只选通过的
+  EXPECT_EQ(runner_fixture("CTEST_FIXTURE_FAIL=1", "-f fixture.pass " CTEST_TEST_FIXTURE, out, sizeof(out)), 0);
+
+  EXPECT_EQ(runner_fixture("", "/nonexistent/runner_fixture", out, sizeof(out)), 1);
+  EXPECT_TRUE(strstr(out, "can't list tests") != NULL);
+}
+
+// -j时每个测试的输出整块打印, 按完成的顺序
+TEST(runner, jobs_output) {
+  char out[32768], *slow, *pass;
+
+  EXPECT_EQ(runner_fixture("", "-j 4 " CTEST_TEST_FIXTURE, out, sizeof(out)), 0);
+  slow = strstr(out, "[ RUN      ] fixture.slow\nslow 0\nslow 1\nslow 2\n[       OK ] fixture.slow");
+  pass = strstr(out, "[ RUN      ] fixture.pass\n[       OK ] fixture.pass");
+  EXPECT_TRUE(slow != NULL);
+  EXPECT_TRUE(pass != NULL && pass < slow);
+  EXPECT_TRUE(strstr(out, "ran on 4 slots") != NULL);
+}
+
+static int runner_copy(const char *from, const char *to) {
+  char cmd[512];
+
+  snprintf(cmd, sizeof(cmd), "cp -f %s %s", from, to);
+  return system(cmd);
+}
+
+// 命中时跳过; 白名单里的环境变量, 参数里的文件, 依赖的so变了都要重跑
+TEST(runner, cache) {
+  char dir[64], dep[128], pre[128], opts[1024], env[512], out[32768];
+
+  snprintf(dir, sizeof(dir), "/tmp/ctest_cache_XXXXXX");
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  snprintf(dep, sizeof(dep), "%s/dep.so", dir);
+  snprintf(pre, sizeof(pre), "%s/pre.so", dir);
+  ASSERT_EQ(runner_copy(CTEST_TEST_LIBS "/runner_dep1.so", dep), 0);
+  ASSERT_EQ(runner_copy(CTEST_TEST_LIBS "/runner_dep1.so", pre), 0);
+  snprintf(opts, sizeof(opts), "--cache-dir=%s/cache --cache-env=CTEST_FIXTURE_TAG %s -- --load=%s",
+           dir, CTEST_TEST_FIXTURE, dep);
+
+  snprintf(env, sizeof(env), "CTEST_FIXTURE_TAG=a LD_PRELOAD=%s", pre);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  PASSED  ] 4 tests.") != NULL);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  PASSED  ] 0 tests.") != NULL);
+  EXPECT_TRUE(strstr(out, "[  CACHED  ] 4 tests.") != NULL);
+
+  // 环境变量
+  snprintf(env, sizeof(env), "CTEST_FIXTURE_TAG=b LD_PRELOAD=%s", pre);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  CACHED  ]") == NULL);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  CACHED  ] 4 tests.") != NULL);
+
+  // 参数里的文件
+  EXPECT_EQ(runner_copy(CTEST_TEST_LIBS "/runner_dep2.so", dep), 0);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  CACHED  ]") == NULL);
+
+  // 依赖的so
+  EXPECT_EQ(runner_copy(CTEST_TEST_LIBS "/runner_dep2.so", pre), 0);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  CACHED  ]") == NULL);
+  EXPECT_EQ(runner_fixture(env, opts, out, sizeof(out)), 0);
+  EXPECT_TRUE(strstr(out, "[  CACHED  ] 4 tests.") != NULL);
+
+  snprintf(opts, sizeof(opts), "rm -rf %s", dir);
+  EXPECT_EQ(system(opts), 0);
+}
+
+// 等到文件里出现cnt次str, 返回出现的次数
+static int runner_wait(const char *path, const char *str, int cnt, int ms) {
+  char buf[65536], *p;
+  int fd, n, i, found = 0;
+
+  for (i = 0; i <= ms / 20; i++) {
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+      n = read(fd, buf, sizeof(buf) - 1);
+      close(fd);
+      buf[n > 0 ? n : 0] = '\0';
+
+      for (found = 0, p = buf; (p = strstr(p, str)) != NULL; p += strlen(str)) found++;
+
+      if (found >= cnt) break;
+    }
+
+    usleep(20 * 1000);
+  }
+
+  return found;
+}
+
+// 失败的记在state文件里; 测试程序所在目录里别的文件变了不算, 测试程序和--watch-path变了只重跑失败的
+TEST(runner, watch) {
+  char dir[64], bin[128], state[128], out[128], wdir[128], cmd[512], buf[1024];
+  pid_t pid;
+  int fd, n;
+
+  snprintf(dir, sizeof(dir), "/tmp/ctest_watch_XXXXXX");
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  snprintf(bin, sizeof(bin), "%s/fixture", dir);
+  snprintf(state, sizeof(state), "%s/state", dir);
+  snprintf(out, sizeof(out), "%s/out", dir);
+  snprintf(wdir, sizeof(wdir), "%s/w", dir);
+  ASSERT_EQ(runner_copy(CTEST_TEST_FIXTURE, bin), 0);
+  ASSERT_EQ(mkdir(wdir, 0755), 0);
+  close(open(state, O_WRONLY | O_CREAT, 0600));
+  fflush(stdout);
+
+  if ((pid = fork()) == 0) {
+    setenv("CTEST_FIXTURE_FAIL", "1", 1);
+    setenv("CTEST_RUNNER_STATE", state, 1);
+
+    if (freopen(out, "w", stdout) == NULL) _exit(127);
+
+    dup2(STDOUT_FILENO, STDERR_FILENO);
+    snprintf(cmd, sizeof(cmd), "--watch-path=%s", wdir);
+    execl(CTEST_TEST_RUNNER, "ctest-runner", "--watch", cmd, bin, (char *)NULL);
+    _exit(127);
+  }
+
+  ASSERT_TRUE(pid > 0);
+  EXPECT_EQ(runner_wait(out, "watching for changes", 1, 5000), 1);
+  EXPECT_EQ(runner_wait(out, "Running 4 tests on", 1, 0), 1);
+
+  fd = open(state, O_RDONLY);
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  buf[n > 0 ? n : 0] = '\0';
+  snprintf(cmd, sizeof(cmd), "%s\tfixture.fail\n", bin);
+  EXPECT_TRUE(strcmp(buf, cmd) == 0);
+
+  // 同一个目录里别的文件
+  snprintf(cmd, sizeof(cmd), "%s/other", dir);
+  close(open(cmd, O_WRONLY | O_CREAT, 0600));
+  EXPECT_EQ(runner_wait(out, "change detected", 1, 600), 0);
+
+  // 测试程序重新生成
+  EXPECT_EQ(runner_copy(CTEST_TEST_FIXTURE, bin), 0);
+  EXPECT_EQ(runner_wait(out, "watching for changes", 2, 5000), 2);
+  EXPECT_EQ(runner_wait(out, "change detected", 1, 0), 1);
+  EXPECT_EQ(runner_wait(out, "Running 1 tests on", 1, 0), 1);
+
+  // --watch-path里的任何变化
+  snprintf(cmd, sizeof(cmd), "%s/x", wdir);
+  close(open(cmd, O_WRONLY | O_CREAT, 0600));
+  EXPECT_EQ(runner_wait(out, "watching for changes", 3, 5000), 3);
+  EXPECT_EQ(runner_wait(out, "Running 1 tests on", 2, 0), 2);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  EXPECT_EQ(system(cmd), 0);
+}
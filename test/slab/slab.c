@@ -0,0 +1,145 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "ctest.h"
+#include "ctest_slab.h"
+
+#define SLAB_OBJS 1000
+
+TEST(slab, alloc_free) {
+  ctest_pool_t *pool;
+  ctest_slab_t *slab;
+  ctest_slab_stat_t st[CTEST_SLAB_CLASSES];
+  uint8_t *p[SLAB_OBJS], *q;
+  int i, n, inuse;
+
+  pool = ctest_pool_create(4096);
+  slab = ctest_slab_create(pool, 0);
+  ASSERT_TRUE(slab != NULL);
+
+  for (i = 0; i < SLAB_OBJS; i++) {
+    p[i] = (uint8_t *)ctest_slab_alloc(slab, i % 300);
+    ASSERT_TRUE(p[i] != NULL);
+    EXPECT_TRUE(((uintptr_t)p[i] & 15) == 0);
+    memset(p[i], i & 0xff, i % 300);
+  }
+
+  for (i = 0; i < SLAB_OBJS; i++) {
+    if (i % 300 > 0) EXPECT_EQ(p[i][i % 300 - 1], i & 0xff);
+  }
+
+  // 释放以后同一级马上复用
+  q = p[10];
+  ctest_slab_free(slab, q);
+  EXPECT_TRUE(ctest_slab_alloc(slab, 10) == q);
+
+  n = ctest_slab_stats(slab, st, CTEST_SLAB_CLASSES);
+
+  for (i = inuse = 0; i < n; i++) inuse += st[i].inuse;
+
+  EXPECT_EQ(inuse, SLAB_OBJS);
+
+  for (i = 0; i < SLAB_OBJS; i++) ctest_slab_free(slab, p[i]);
+
+  ctest_slab_destroy(slab);
+  ctest_pool_destroy(pool);
+}
+
+TEST(slab, large) {
+  ctest_pool_t *pool;
+  ctest_slab_t *slab;
+  uint8_t *p;
+
+  pool = ctest_pool_create(4096);
+  slab = ctest_slab_create(pool, 0);
+  p = (uint8_t *)ctest_slab_alloc(slab, 100000);
+  ASSERT_TRUE(p != NULL);
+  EXPECT_TRUE(((uintptr_t)p & 15) == 0);
+  memset(p, 1, 100000);
+  EXPECT_EQ(slab->large_alloc, 1);
+  ctest_slab_free(slab, p);
+  EXPECT_EQ(slab->large_free, 1);
+  EXPECT_TRUE(pool->large == NULL);
+  ctest_pool_destroy(pool);
+}
+
+// 大对象在pool上, 不free直接clear也不会漏
+TEST(slab, large_cleared_with_pool) {
+  ctest_pool_t *pool;
+  ctest_slab_t *slab;
+  uint8_t *p, *q;
+
+  pool = ctest_pool_create(64 * 1024);
+  slab = ctest_slab_create(pool, 0);
+  p = (uint8_t *)ctest_slab_alloc(slab, 100000);
+  q = (uint8_t *)ctest_slab_alloc(slab, 8000);
+  ASSERT_TRUE(p != NULL && q != NULL);
+  EXPECT_TRUE(pool->large != NULL);
+  memset(p, 1, 100000);
+  memset(q, 2, 8000);
+
+  // block里的free什么都不做
+  ctest_slab_free(slab, q);
+  EXPECT_EQ(slab->large_free, 1);
+  ctest_pool_clear(pool);
+  EXPECT_TRUE(pool->large == NULL);
+  ctest_pool_destroy(pool);
+}
+
+typedef struct slab_thread_t {
+  ctest_slab_t *slab;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int stage;
+} slab_thread_t;
+
+static void slab_thread_wait(slab_thread_t *st, int stage) {
+  pthread_mutex_lock(&st->lock);
+
+  while (st->stage < stage) pthread_cond_wait(&st->cond, &st->lock);
+
+  pthread_mutex_unlock(&st->lock);
+}
+
+static void slab_thread_stage(slab_thread_t *st, int stage) {
+  pthread_mutex_lock(&st->lock);
+  st->stage = stage;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+}
+
+static void *slab_thread_run(void *arg) {
+  slab_thread_t *st = (slab_thread_t *)arg;
+  void *p[100];
+  int i;
+
+  for (i = 0; i < 100; i++) p[i] = ctest_slab_alloc(st->slab, 48);
+
+  for (i = 0; i < 100; i++) ctest_slab_free(st->slab, p[i]);
+
+  // 线程还活着的时候pool被destroy, 退出时不能再碰slab
+  slab_thread_stage(st, 1);
+  slab_thread_wait(st, 2);
+  return NULL;
+}
+
+TEST(slab, thread_cache_outlived) {
+  ctest_pool_t *pool;
+  slab_thread_t st;
+  pthread_t tid;
+
+  pool = ctest_pool_create(4096);
+  memset(&st, 0, sizeof(st));
+  pthread_mutex_init(&st.lock, NULL);
+  pthread_cond_init(&st.cond, NULL);
+  st.slab = ctest_slab_create(pool, CTEST_SLAB_THREAD_CACHE);
+  ASSERT_TRUE(st.slab != NULL);
+
+  pthread_create(&tid, NULL, slab_thread_run, &st);
+  slab_thread_wait(&st, 1);
+  ctest_pool_destroy(pool);
+  slab_thread_stage(&st, 2);
+  pthread_join(tid, NULL);
+  pthread_mutex_destroy(&st.lock);
+  pthread_cond_destroy(&st.cond);
+}
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#include "ctest.h"
+#include "ctest_string.h"
+
+#define STRING_MAX_LEN 200
+
+// 数据放在分配出来的内存末尾, 多读一个字节asan就能发现
+static unsigned char *string_tail(unsigned char **mem, int len, int off) {
+  *mem = (unsigned char *)malloc(len + off + 1);
+  return *mem + 1 + off;
+}
+
+// 每个长度, 每个起始对齐, 每个位置上的不同都要找到
+TEST(string, mismatch_misaligned) {
+  unsigned char *ma, *mb, *a, *b;
+  int len, oa, ob, i, bad = 0;
+
+  for (len = 0; len <= STRING_MAX_LEN; len++) {
+    for (oa = 0; oa < 4; oa++) {
+      for (ob = 0; ob < 4; ob += 3) {
+        a = string_tail(&ma, len, oa);
+        b = string_tail(&mb, len, ob);
+
+        for (i = 0; i < len; i++) a[i] = b[i] = (unsigned char)(i * 7 + 1);
+
+        if (ctest_string_mismatch(a, b, len) != -1) bad++;
+
+        for (i = 0; i < len; i++) {
+          // 只差最高位, 前面的字节相同
+          b[i] ^= 0x80;
+
+          if (ctest_string_mismatch(a, b, len) != i) bad++;
+
+          b[i] ^= 0x80;
+        }
+
+        free(ma);
+        free(mb);
+      }
+    }
+  }
+
+  EXPECT_EQ(bad, 0);
+}
+
+// 有多处不同时返回第一处, 后面的字节不影响结果
+TEST(string, mismatch_first) {
+  unsigned char a[STRING_MAX_LEN], b[STRING_MAX_LEN];
+  int i, j, bad = 0;
+
+  memset(a, 'x', sizeof(a));
+
+  for (i = 0; i < STRING_MAX_LEN; i++) {
+    memcpy(b, a, sizeof(b));
+
+    for (j = i; j < STRING_MAX_LEN; j += 5) b[j] = 'y';
+
+    if (ctest_string_mismatch(a, b, STRING_MAX_LEN) != i) bad++;
+
+    // 长度到不同的地方为止时相同
+    if (ctest_string_mismatch(a, b, i) != -1) bad++;
+  }
+
+  EXPECT_EQ(bad, 0);
+  EXPECT_EQ(ctest_string_mismatch(NULL, NULL, 0), -1);
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ctest.h"
+#include "ctest_trace.h"
+
+static const char *trace_json_value(const char *p);
+
+static const char *trace_json_space(const char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+
+  return p;
+}
+
+static const char *trace_json_string(const char *p) {
+  if (*p++ != '"') return NULL;
+
+  for (; *p != '"'; p++) {
+    if ((unsigned char)*p < 0x20) return NULL;
+
+    if (*p == '\\') {
+      p++;
+
+      if (*p == 'u') {
+        if (strspn(p + 1, "0123456789abcdefABCDEF") < 4) return NULL;
+
+        p += 4;
+      } else if (strchr("\"\\/bfnrt", *p) == NULL || *p == '\0') {
+        return NULL;
+      }
+    }
+  }
+
+  return p + 1;
+}
+
+static const char *trace_json_number(const char *p) {
+  const char *s;
+
+  if (*p == '-') p++;
+
+  if ((s = p, p += strspn(p, "0123456789")) == s) return NULL;
+
+  if (*p == '.' && (s = ++p, p += strspn(p, "0123456789")) == s) return NULL;
+
+  return p;
+}
+
+// 成员之间的逗号和结尾都要对得上, 多一个少一个都不行
+static const char *trace_json_list(const char *p, char end, int object) {
+  p = trace_json_space(p + 1);
+
+  if (*p == end) return p + 1;
+
+  for (;;) {
+    if (object) {
+      if ((p = trace_json_string(trace_json_space(p))) == NULL) return NULL;
+
+      if (*(p = trace_json_space(p)) != ':') return NULL;
+
+      p++;
+    }
+
+    if ((p = trace_json_value(p)) == NULL) return NULL;
+
+    p = trace_json_space(p);
+
+    if (*p == end) return p + 1;
+
+    if (*p++ != ',') return NULL;
+  }
+}
+
+static const char *trace_json_value(const char *p) {
+  p = trace_json_space(p);
+
+  if (*p == '{') return trace_json_list(p, '}', 1);
+
+  if (*p == '[') return trace_json_list(p, ']', 0);
+
+  if (*p == '"') return trace_json_string(p);
+
+  if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0) return p + 4;
+
+  if (strncmp(p, "false", 5) == 0) return p + 5;
+
+  return trace_json_number(p);
+}
+
+static int trace_json_valid(const char *s) {
+  const char *p = trace_json_value(s);
+  return (p && *trace_json_space(p) == '\0');
+}
+
+static int trace_read(const char *path, char *buf, int size) {
+  FILE *fp;
+  int n;
+
+  buf[0] = '\0';
+
+  if ((fp = fopen(path, "r")) == NULL) return -1;
+
+  n = fread(buf, 1, size - 1, fp);
+  buf[n] = '\0';
+  fclose(fp);
+  return n;
+}
+
+static int trace_count(const char *s, const char *sub) {
+  int n = 0;
+
+  for (; (s = strstr(s, sub)) != NULL; s++) n++;
+
+  return n;
+}
+
+// 在子进程里打开trace, 不动runner自己的trace
+static int trace_child(const char *path, const char *lane, const char *name) {
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+
+  if ((pid = fork()) == 0) {
+    setenv(CTEST_TRACE_WORKER_ENV, lane, 1);
+    ctest_trace_open(path);
+    {
+      CTEST_TRACE_SCOPE(name);
+      {
+        CTEST_TRACE_SCOPE("inner");
+        usleep(1000);
+      }
+    }
+    _exit(ctest_trace_close() == CTEST_OK ? 0 : 1);
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) != pid) return -1;
+
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+TEST(trace, validator) {
+  EXPECT_TRUE(trace_json_valid("{\"a\":[1,-2.5,\"x\\\"\",true,null,{}],\"b\":[]}"));
+  EXPECT_FALSE(trace_json_valid("{\"a\":[1,2,]}"));
+  EXPECT_FALSE(trace_json_valid("{\"a\":1,}"));
+  EXPECT_FALSE(trace_json_valid("[,1]"));
+  EXPECT_FALSE(trace_json_valid("{\"a\":\"x\ny\"}"));
+  EXPECT_FALSE(trace_json_valid("{} {}"));
+}
+
+// 作用域结束时记一个span, 名字里的引号要转义, worker线程在自己的lane上
+TEST(trace, scope) {
+  char path[64], buf[16384];
+
+  snprintf(path, sizeof(path), "/tmp/ctest_trace_%d.json", (int)getpid());
+  ASSERT_EQ(trace_child(path, "3", "outer \"q\""), 0);
+  ASSERT_TRUE(trace_read(path, buf, sizeof(buf)) > 0);
+  unlink(path);
+
+  EXPECT_TRUE(trace_json_valid(buf));
+  EXPECT_TRUE(strstr(buf, "{\"name\":\"outer \\\"q\\\"\",\"cat\":\"user\",\"ph\":\"X\"") != NULL);
+  EXPECT_TRUE(strstr(buf, "{\"name\":\"inner\",\"cat\":\"user\",\"ph\":\"X\"") != NULL);
+  EXPECT_EQ(trace_count(buf, "\"tid\":3"), 3);
+  EXPECT_TRUE(strstr(buf, "\"name\":\"worker 3\"") != NULL);
+
+  // inner先结束, 先记下来
+  EXPECT_TRUE(strstr(buf, "\"inner\"") < strstr(buf, "\"outer"));
+}
+
+// 没打开trace时什么都不记
+TEST(trace, scope_disabled) {
+  int enabled = ctest_trace_enabled;
+
+  ctest_trace_enabled = 0;
+  {
+    // 变量名里带着行号, 要写在同一行
+    CTEST_TRACE_SCOPE("off"); EXPECT_EQ(CTEST_TRACE_CONCAT(ctest_trace_scope_, __LINE__).start, 0);
+  }
+  ctest_trace_enabled = enabled;
+}
+
+// 合并以后还是一个合法的json, 每个lane的名字只出现一次, 原来的文件删掉
+TEST(trace, merge) {
+  char out[64], f0[64], f1[64], none[64], buf[16384];
+  char *files[3] = {f0, none, f1};
+
+  snprintf(out, sizeof(out), "/tmp/ctest_trace_%d.json", (int)getpid());
+  snprintf(f0, sizeof(f0), "/tmp/ctest_trace_%d.0", (int)getpid());
+  snprintf(f1, sizeof(f1), "/tmp/ctest_trace_%d.1", (int)getpid());
+  snprintf(none, sizeof(none), "/tmp/ctest_trace_%d.none", (int)getpid());
+
+  ASSERT_EQ(trace_child(f0, "0", "first"), 0);
+  ASSERT_EQ(trace_child(f1, "1", "second"), 0);
+  EXPECT_EQ(ctest_trace_merge(out, files, 3, 2), CTEST_OK);
+  ASSERT_TRUE(trace_read(out, buf, sizeof(buf)) > 0);
+  unlink(out);
+
+  EXPECT_TRUE(trace_json_valid(buf));
+  EXPECT_EQ(trace_count(buf, "\"name\":\"worker 0\""), 1);
+  EXPECT_EQ(trace_count(buf, "\"name\":\"worker 1\""), 1);
+  EXPECT_EQ(trace_count(buf, "\"name\":\"inner\""), 2);
+  EXPECT_TRUE(strstr(buf, "\"name\":\"first\"") != NULL);
+  EXPECT_TRUE(strstr(buf, "\"name\":\"second\"") != NULL);
+  EXPECT_TRUE(access(f0, F_OK) != 0);
+  EXPECT_TRUE(access(f1, F_OK) != 0);
+
+  // 没有事件也没有lane
+  EXPECT_EQ(ctest_trace_merge(out, files, 0, 0), CTEST_OK);
+  ASSERT_TRUE(trace_read(out, buf, sizeof(buf)) > 0);
+  unlink(out);
+  EXPECT_TRUE(trace_json_valid(buf));
+}